@@ -0,0 +1,178 @@
+
+/* expand_sse2_intrinsics.c - SSE2 optimized read transforms
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ *
+ * png_do_expand() with a tRNS color: the alpha channel of 8 bit grey, 16 bit
+ * grey and 8 bit RGB rows is built by comparing 16 bytes at a time against
+ * the transparent color.  Like the C code this works in place, from the end
+ * of the row backwards: each block is loaded before its (twice or 4/3 as
+ * large) result is stored, and no result reaches the input of the blocks
+ * still to come.  The few pixels left at the start of the row go byte by
+ * byte.
+ */
+
+#include "../pngpriv.h"
+
+#if PNG_INTEL_SSE2_OPT > 0
+
+#include <emmintrin.h>
+
+static PNG_SSE2_TARGET void
+expand_gray8_trns(png_bytep row, png_uint_32 width, png_byte gray)
+{
+   const __m128i key = _mm_set1_epi8((char)gray);
+   const __m128i ones = _mm_set1_epi8(-1);
+   png_uint_32 i = width;
+
+   while (i >= 16)
+   {
+      __m128i g, a;
+
+      i -= 16;
+      g = _mm_loadu_si128((const __m128i *)(row + i));
+      a = _mm_xor_si128(_mm_cmpeq_epi8(g, key), ones);
+      _mm_storeu_si128((__m128i *)(row + 2*i), _mm_unpacklo_epi8(g, a));
+      _mm_storeu_si128((__m128i *)(row + 2*i + 16), _mm_unpackhi_epi8(g, a));
+   }
+
+   while (i > 0)
+   {
+      png_byte g = row[--i];
+
+      row[2*i + 1] = (png_byte)(g == gray ? 0 : 0xff);
+      row[2*i] = g;
+   }
+}
+
+static PNG_SSE2_TARGET void
+expand_gray16_trns(png_bytep row, png_uint_32 width, png_uint_16 gray)
+{
+   /* The samples are big endian, the lanes little endian. */
+   const __m128i key = _mm_set1_epi16((short)(((gray & 0xff) << 8) |
+       (gray >> 8)));
+   const __m128i ones = _mm_set1_epi8(-1);
+   const png_byte gray_high = (png_byte)(gray >> 8);
+   const png_byte gray_low = (png_byte)(gray & 0xff);
+   png_uint_32 i = width;
+
+   while (i >= 8)
+   {
+      __m128i g, a;
+
+      i -= 8;
+      g = _mm_loadu_si128((const __m128i *)(row + 2*i));
+      a = _mm_xor_si128(_mm_cmpeq_epi16(g, key), ones);
+      _mm_storeu_si128((__m128i *)(row + 4*i), _mm_unpacklo_epi16(g, a));
+      _mm_storeu_si128((__m128i *)(row + 4*i + 16), _mm_unpackhi_epi16(g, a));
+   }
+
+   while (i > 0)
+   {
+      png_byte high, low, a;
+
+      --i;
+      high = row[2*i];
+      low = row[2*i + 1];
+      a = (png_byte)(high == gray_high && low == gray_low ? 0 : 0xff);
+      row[4*i + 3] = a;
+      row[4*i + 2] = a;
+      row[4*i + 1] = low;
+      row[4*i] = high;
+   }
+}
+
+/* Four pixels per step: lane k of the result is bytes 3k..3k+2 of the
+ * input, which is where a byte shift by k puts them.  The load takes 4 bytes
+ * past the pixels, which the row buffer (sized for the RGBA result) has.
+ */
+static PNG_SSE2_TARGET void
+expand_rgb8_trns(png_bytep row, png_uint_32 width, png_byte red,
+    png_byte green, png_byte blue)
+{
+   const __m128i key = _mm_set1_epi32(red | (green << 8) | (blue << 16));
+   const __m128i alpha = _mm_set1_epi32((int)0xff000000U);
+   const __m128i lane0 = _mm_set_epi32(0, 0, 0, 0xffffff);
+   const __m128i lane1 = _mm_set_epi32(0, 0, 0xffffff, 0);
+   const __m128i lane2 = _mm_set_epi32(0, 0xffffff, 0, 0);
+   const __m128i lane3 = _mm_set_epi32(0xffffff, 0, 0, 0);
+   png_uint_32 i = width;
+
+   while (i >= 4)
+   {
+      __m128i v, p;
+
+      i -= 4;
+      v = _mm_loadu_si128((const __m128i *)(row + 3*i));
+      p = _mm_or_si128(
+          _mm_or_si128(_mm_and_si128(v, lane0),
+                       _mm_and_si128(_mm_slli_si128(v, 1), lane1)),
+          _mm_or_si128(_mm_and_si128(_mm_slli_si128(v, 2), lane2),
+                       _mm_and_si128(_mm_slli_si128(v, 3), lane3)));
+      p = _mm_or_si128(p, _mm_andnot_si128(_mm_cmpeq_epi32(p, key), alpha));
+      _mm_storeu_si128((__m128i *)(row + 4*i), p);
+   }
+
+   while (i > 0)
+   {
+      png_byte r, g, b;
+
+      --i;
+      r = row[3*i];
+      g = row[3*i + 1];
+      b = row[3*i + 2];
+      row[4*i + 3] = (png_byte)(r == red && g == green && b == blue ? 0 : 0xff);
+      row[4*i + 2] = b;
+      row[4*i + 1] = g;
+      row[4*i] = r;
+   }
+}
+
+/* Returns 0 if the row is left to the C code. */
+int /* PRIVATE */
+png_do_expand_sse2(png_row_infop row_info, png_bytep row,
+    png_const_color_16p trans_color)
+{
+   png_uint_32 width = row_info->width;
+
+   if (trans_color == NULL || !png_have_sse2())
+      return 0;
+
+   if (row_info->color_type == PNG_COLOR_TYPE_GRAY)
+   {
+      /* An 8 bit key above 255 never matches; rare enough for the C code. */
+      if (row_info->bit_depth == 8 && trans_color->gray <= 0xff)
+         expand_gray8_trns(row, width, (png_byte)trans_color->gray);
+
+      else if (row_info->bit_depth == 16)
+         expand_gray16_trns(row, width, trans_color->gray);
+
+      else
+         return 0;
+
+      row_info->color_type = PNG_COLOR_TYPE_GRAY_ALPHA;
+      row_info->channels = 2;
+   }
+
+   else if (row_info->color_type == PNG_COLOR_TYPE_RGB &&
+       row_info->bit_depth == 8)
+   {
+      expand_rgb8_trns(row, width, (png_byte)(trans_color->red & 0xff),
+          (png_byte)(trans_color->green & 0xff),
+          (png_byte)(trans_color->blue & 0xff));
+      row_info->color_type = PNG_COLOR_TYPE_RGB_ALPHA;
+      row_info->channels = 4;
+   }
+
+   else
+      return 0;
+
+   row_info->pixel_depth = (png_byte)(row_info->bit_depth *
+       row_info->channels);
+   row_info->rowbytes = PNG_ROWBYTES(row_info->pixel_depth, width);
+   return 1;
+}
+
+#endif /* PNG_INTEL_SSE2_OPT */
@@ -0,0 +1,415 @@
+
+/* filter_sse2_intrinsics.c - SSE2 optimized filter functions
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ *
+ * Row unfilter functions for 3 and 4 byte pixels (RGB8, RGBA8).  Sub, Avg
+ * and Paeth depend on the pixel to the left, so the work is vectorized across
+ * the bytes of a pixel (and for Sub across a group of pixels using a prefix
+ * sum), not across the row.  3 byte Paeth is left to the C code, with only
+ * 3 useful lanes the vector version loses to it.  Installed by
+ * png_init_filter_functions_sse2() in intel_init.c once CPUID reports SSE2.
+ *
+ * On write the left pixel is already known, so png_write_find_filter_sse2()
+ * filters and scores all candidates 16 bytes at a time, for any pixel size.
+ */
+
+#include "../pngpriv.h"
+
+#if PNG_INTEL_SSE2_OPT > 0
+
+#include <emmintrin.h>
+
+/* Avg needs floor((a + b) / 2); pavgb rounds up, so take off the low bit of
+ * a ^ b again.
+ */
+static PNG_SSE2_TARGET __m128i
+avg_floor(__m128i a, __m128i b)
+{
+   __m128i avg = _mm_avg_epu8(a, b);
+   return _mm_sub_epi8(avg,
+      _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+/* Paeth on 16 bit lanes.  With p = a + b - c the three distances are
+ * pa = |b - c|, pb = |a - c| and pc = |(b - c) + (a - c)|; ties prefer a,
+ * then b, exactly like the C code in pngrutil.c and pngwutil.c.
+ */
+static PNG_SSE2_TARGET __m128i
+abs_i16(__m128i x)
+{
+   return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static PNG_SSE2_TARGET __m128i
+if_then_else(__m128i c, __m128i t, __m128i e)
+{
+   return _mm_or_si128(_mm_and_si128(c, t), _mm_andnot_si128(c, e));
+}
+
+static PNG_SSE2_TARGET __m128i
+paeth_predict(__m128i a, __m128i b, __m128i c)
+{
+   __m128i pa = _mm_sub_epi16(b, c);
+   __m128i pb = _mm_sub_epi16(a, c);
+   __m128i pc = _mm_add_epi16(pa, pb);
+   __m128i smallest;
+
+   pa = abs_i16(pa);
+   pb = abs_i16(pb);
+   pc = abs_i16(pc);
+   smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+   return if_then_else(_mm_cmpeq_epi16(smallest, pa), a,
+      if_then_else(_mm_cmpeq_epi16(smallest, pb), b, c));
+}
+
+#ifdef PNG_READ_SUPPORTED
+
+/* Load and store exactly 3 or 4 bytes without assuming any alignment and
+ * without touching bytes outside the row.  The 3 byte versions assemble the
+ * value in a register: going through memory here stalls store forwarding.
+ */
+static PNG_SSE2_TARGET __m128i
+load4(const void *p)
+{
+   png_uint_32 v;
+   memcpy(&v, p, 4);
+   return _mm_cvtsi32_si128((int)v);
+}
+
+static PNG_SSE2_TARGET void
+store4(void *p, __m128i v)
+{
+   png_uint_32 x = (png_uint_32)_mm_cvtsi128_si32(v);
+   memcpy(p, &x, 4);
+}
+
+static PNG_SSE2_TARGET __m128i
+load3(png_const_bytep p)
+{
+   png_uint_32 v = p[0] | ((png_uint_32)p[1] << 8) | ((png_uint_32)p[2] << 16);
+   return _mm_cvtsi32_si128((int)v);
+}
+
+static PNG_SSE2_TARGET void
+store3(png_bytep p, __m128i v)
+{
+   png_uint_32 x = (png_uint_32)_mm_cvtsi128_si32(v);
+   p[0] = (png_byte)x;
+   p[1] = (png_byte)(x >> 8);
+   p[2] = (png_byte)(x >> 16);
+}
+
+void PNG_SSE2_TARGET
+png_read_filter_row_sub3_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+{
+   /* 4 pixels (12 bytes) per step: add the carry from the last pixel to the
+    * first one, then a prefix sum over the pixels.  The 16 byte load must not
+    * run past the row, hence the extra 4 bytes in the loop condition.
+    */
+   png_size_t rb = row_info->rowbytes;
+   const __m128i mask3 = _mm_cvtsi32_si128(0xffffff);
+   __m128i a = _mm_setzero_si128();
+
+   PNG_UNUSED(prev)
+
+   while (rb >= 16)
+   {
+      __m128i d = _mm_loadu_si128((const __m128i*)row);
+      d = _mm_add_epi8(d, a);
+      d = _mm_add_epi8(d, _mm_slli_si128(d, 3));
+      d = _mm_add_epi8(d, _mm_slli_si128(d, 6));
+      _mm_storel_epi64((__m128i*)row, d);
+      store4(row + 8, _mm_srli_si128(d, 8));
+      a = _mm_and_si128(_mm_srli_si128(d, 9), mask3);
+      row += 12;
+      rb -= 12;
+   }
+
+   while (rb >= 3)
+   {
+      __m128i d = _mm_add_epi8(load3(row), a);
+      store3(row, d);
+      a = d;
+      row += 3;
+      rb -= 3;
+   }
+}
+
+void PNG_SSE2_TARGET
+png_read_filter_row_sub4_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+{
+   png_size_t rb = row_info->rowbytes;
+   __m128i a = _mm_setzero_si128();
+
+   PNG_UNUSED(prev)
+
+   while (rb >= 16)
+   {
+      __m128i d = _mm_loadu_si128((const __m128i*)row);
+      d = _mm_add_epi8(d, a);
+      d = _mm_add_epi8(d, _mm_slli_si128(d, 4));
+      d = _mm_add_epi8(d, _mm_slli_si128(d, 8));
+      _mm_storeu_si128((__m128i*)row, d);
+      a = _mm_srli_si128(d, 12);
+      row += 16;
+      rb -= 16;
+   }
+
+   while (rb >= 4)
+   {
+      __m128i d = _mm_add_epi8(load4(row), a);
+      store4(row, d);
+      a = d;
+      row += 4;
+      rb -= 4;
+   }
+}
+
+void PNG_SSE2_TARGET
+png_read_filter_row_avg3_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+{
+   png_size_t rb = row_info->rowbytes;
+   __m128i a = _mm_setzero_si128();
+
+   while (rb >= 3)
+   {
+      __m128i b = load3(prev);
+      __m128i d = _mm_add_epi8(load3(row), avg_floor(a, b));
+      store3(row, d);
+      a = d;
+      row += 3;
+      prev += 3;
+      rb -= 3;
+   }
+}
+
+void PNG_SSE2_TARGET
+png_read_filter_row_avg4_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+{
+   png_size_t rb = row_info->rowbytes;
+   __m128i a = _mm_setzero_si128();
+
+   while (rb >= 4)
+   {
+      __m128i b = load4(prev);
+      __m128i d = _mm_add_epi8(load4(row), avg_floor(a, b));
+      store4(row, d);
+      a = d;
+      row += 4;
+      prev += 4;
+      rb -= 4;
+   }
+}
+
+void PNG_SSE2_TARGET
+png_read_filter_row_paeth4_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+{
+   png_size_t rb = row_info->rowbytes;
+   const __m128i zero = _mm_setzero_si128();
+   __m128i a = zero, c = zero;
+
+   while (rb >= 4)
+   {
+      __m128i b = _mm_unpacklo_epi8(load4(prev), zero);
+      __m128i d = load4(row);
+      d = _mm_add_epi8(d, _mm_packus_epi16(paeth_predict(a, b, c), zero));
+      store4(row, d);
+      a = _mm_unpacklo_epi8(d, zero);
+      c = b;
+      row += 4;
+      prev += 4;
+      rb -= 4;
+   }
+}
+
+#endif /* PNG_READ_SUPPORTED */
+
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+/* The filter heuristic counts a filtered byte v as v when v < 128 and as
+ * 256 - v otherwise, that is min(v, -v) in unsigned bytes.
+ */
+static PNG_SSE2_TARGET __m128i
+add_abs_sum(__m128i sum, __m128i v)
+{
+   const __m128i zero = _mm_setzero_si128();
+   __m128i av = _mm_min_epu8(v, _mm_sub_epi8(zero, v));
+   return _mm_add_epi64(sum, _mm_sad_epu8(av, zero));
+}
+
+static PNG_SSE2_TARGET png_uint_32
+abs_sum_total(__m128i sum)
+{
+   return (png_uint_32)_mm_cvtsi128_si32(sum) +
+      (png_uint_32)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+}
+
+/* Bytes [i, end) in C, for the start of the row (where the pixel to the left
+ * is missing) and the part after the last full 16 bytes.  out[] and sum[]
+ * are in PNG_FILTER_VALUE order, out[PNG_FILTER_VALUE_NONE] is unused.
+ */
+static void
+filter_bytes(png_const_bytep row, png_const_bytep prev, png_bytep *out,
+   png_uint_32 *sum, png_size_t bpp, png_size_t i, png_size_t end)
+{
+   for (; i < end; i++)
+   {
+      int x = row[i], b = prev[i];
+      int a = i >= bpp ? row[i - bpp] : 0;
+      int c = i >= bpp ? prev[i - bpp] : 0;
+      int pa = b - c, pb = a - c, pc = pa + pb;
+      int v[5], f;
+
+      pa = pa < 0 ? -pa : pa;
+      pb = pb < 0 ? -pb : pb;
+      pc = pc < 0 ? -pc : pc;
+
+      v[PNG_FILTER_VALUE_NONE] = x;
+      v[PNG_FILTER_VALUE_SUB] = (x - a) & 0xff;
+      v[PNG_FILTER_VALUE_UP] = (x - b) & 0xff;
+      v[PNG_FILTER_VALUE_AVG] = (x - ((a + b) >> 1)) & 0xff;
+      v[PNG_FILTER_VALUE_PAETH] =
+         (x - ((pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c)) & 0xff;
+
+      for (f = 0; f < PNG_FILTER_VALUE_LAST; f++)
+      {
+         if (f != PNG_FILTER_VALUE_NONE && out[f] != NULL)
+            out[f][i] = (png_byte)v[f];
+
+         sum[f] += v[f] < 128 ? v[f] : 256 - v[f];
+      }
+   }
+}
+
+/* Filters 'row' with every filter in 'filters' in a single pass, storing
+ * each candidate in out[filter type] (out[PNG_FILTER_VALUE_NONE] is unused),
+ * and returns the filter type chosen exactly like the unweighted C code in
+ * png_write_find_filter() does: lowest sum, earlier filter on ties.  The C
+ * code stops scoring a filter once it is worse than the best so far; such a
+ * filter loses here too, its full sum is only larger.  Returns -1 when the
+ * C code has to do the work.
+ */
+int /* PRIVATE */
+png_filter_row_sse2(png_const_bytep row, png_const_bytep prev,
+   png_bytep *out, png_size_t row_bytes, unsigned int bpp,
+   unsigned int filters)
+{
+   png_bytep dst[PNG_FILTER_VALUE_LAST];
+   png_uint_32 sum[PNG_FILTER_VALUE_LAST], mins;
+   __m128i s_none, s_sub, s_up, s_avg, s_paeth;
+   const __m128i zero = _mm_setzero_si128();
+   png_size_t i;
+   int f, best;
+
+   /* Without Up, Avg or Paeth there is no previous row to read. */
+   if (prev == NULL || !png_have_sse2())
+      return -1;
+
+   for (f = 0; f < PNG_FILTER_VALUE_LAST; f++)
+   {
+      dst[f] = (f != PNG_FILTER_VALUE_NONE &&
+         (filters & (PNG_FILTER_NONE << f))) ? out[f] : NULL;
+      sum[f] = 0;
+   }
+
+   /* The vector loop reads the pixel to the left unconditionally, which is
+    * there from byte 16 on (bpp is at most 8).
+    */
+   i = row_bytes < 16 ? row_bytes : 16;
+   filter_bytes(row, prev, dst, sum, bpp, 0, i);
+
+   s_none = s_sub = s_up = s_avg = s_paeth = zero;
+   for (; i + 16 <= row_bytes; i += 16)
+   {
+      __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+      __m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+      __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+      __m128i c = _mm_loadu_si128((const __m128i*)(prev + i - bpp));
+      __m128i sub = _mm_sub_epi8(x, a);
+      __m128i up = _mm_sub_epi8(x, b);
+      __m128i avg = _mm_sub_epi8(x, avg_floor(a, b));
+      __m128i paeth = _mm_sub_epi8(x, _mm_packus_epi16(
+         paeth_predict(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+            _mm_unpacklo_epi8(c, zero)),
+         paeth_predict(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+            _mm_unpackhi_epi8(c, zero))));
+
+      if (dst[PNG_FILTER_VALUE_SUB] != NULL)
+         _mm_storeu_si128((__m128i*)(dst[PNG_FILTER_VALUE_SUB] + i), sub);
+      if (dst[PNG_FILTER_VALUE_UP] != NULL)
+         _mm_storeu_si128((__m128i*)(dst[PNG_FILTER_VALUE_UP] + i), up);
+      if (dst[PNG_FILTER_VALUE_AVG] != NULL)
+         _mm_storeu_si128((__m128i*)(dst[PNG_FILTER_VALUE_AVG] + i), avg);
+      if (dst[PNG_FILTER_VALUE_PAETH] != NULL)
+         _mm_storeu_si128((__m128i*)(dst[PNG_FILTER_VALUE_PAETH] + i), paeth);
+
+      s_none = add_abs_sum(s_none, x);
+      s_sub = add_abs_sum(s_sub, sub);
+      s_up = add_abs_sum(s_up, up);
+      s_avg = add_abs_sum(s_avg, avg);
+      s_paeth = add_abs_sum(s_paeth, paeth);
+   }
+
+   filter_bytes(row, prev, dst, sum, bpp, i, row_bytes);
+
+   sum[PNG_FILTER_VALUE_NONE] += abs_sum_total(s_none);
+   sum[PNG_FILTER_VALUE_SUB] += abs_sum_total(s_sub);
+   sum[PNG_FILTER_VALUE_UP] += abs_sum_total(s_up);
+   sum[PNG_FILTER_VALUE_AVG] += abs_sum_total(s_avg);
+   sum[PNG_FILTER_VALUE_PAETH] += abs_sum_total(s_paeth);
+
+   best = PNG_FILTER_VALUE_NONE;
+   mins = (filters & PNG_FILTER_NONE) ? sum[PNG_FILTER_VALUE_NONE] :
+      (((png_uint_32)(-1)) >> 1);
+
+   for (f = PNG_FILTER_VALUE_SUB; f < PNG_FILTER_VALUE_LAST; f++)
+   {
+      if (dst[f] != NULL && sum[f] < mins)
+      {
+         mins = sum[f];
+         best = f;
+      }
+   }
+
+   return best;
+}
+
+/* png_filter_row_sse2() on the row buffers of png_ptr.  Returns the row to
+ * write or NULL when the C code has to do the work.
+ */
+png_bytep /* PRIVATE */
+png_write_find_filter_sse2(png_structp png_ptr, png_size_t row_bytes,
+   unsigned int bpp, unsigned int filters)
+{
+   png_bytep out[PNG_FILTER_VALUE_LAST];
+   int best;
+
+   if (png_ptr->prev_row == NULL)
+      return NULL;
+
+   out[PNG_FILTER_VALUE_NONE] = NULL;
+   out[PNG_FILTER_VALUE_SUB] = png_ptr->sub_row ? png_ptr->sub_row + 1 : NULL;
+   out[PNG_FILTER_VALUE_UP] = png_ptr->up_row ? png_ptr->up_row + 1 : NULL;
+   out[PNG_FILTER_VALUE_AVG] = png_ptr->avg_row ? png_ptr->avg_row + 1 : NULL;
+   out[PNG_FILTER_VALUE_PAETH] = png_ptr->paeth_row ?
+      png_ptr->paeth_row + 1 : NULL;
+
+   best = png_filter_row_sse2(png_ptr->row_buf + 1, png_ptr->prev_row + 1, out,
+      row_bytes, bpp, filters);
+
+   if (best < 0)
+      return NULL;
+
+   return best == PNG_FILTER_VALUE_NONE ? png_ptr->row_buf : out[best] - 1;
+}
+#endif /* PNG_WRITE_FILTER_SUPPORTED */
+
+#endif /* PNG_INTEL_SSE2_OPT */
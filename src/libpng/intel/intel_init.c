@@ -0,0 +1,69 @@
+
+/* intel_init.c - SSE2 optimized filter functions
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ *
+ * Runtime selection of the x86 SIMD code.  SSE2 is always there on x86-64,
+ * but 32 bit builds may run on CPUs without it, so ask CPUID.
+ */
+
+#include "../pngpriv.h"
+
+#if PNG_INTEL_SSE2_OPT > 0
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#elif defined(__GNUC__)
+#  include <cpuid.h>
+#endif
+
+int /* PRIVATE */
+png_have_sse2(void)
+{
+   static int have_sse2 = -1;
+
+   if (have_sse2 < 0)
+   {
+#if defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64)
+      have_sse2 = 1;
+#elif defined(_MSC_VER)
+      int info[4];
+      __cpuid(info, 1);
+      have_sse2 = (info[3] >> 26) & 1;
+#elif defined(__GNUC__)
+      unsigned int a, b, c, d;
+      have_sse2 = __get_cpuid(1, &a, &b, &c, &d) ? (int)((d >> 26) & 1) : 0;
+#else
+      have_sse2 = 0;
+#endif
+   }
+
+   return have_sse2;
+}
+
+#ifdef PNG_READ_SUPPORTED
+void /* PRIVATE */
+png_init_filter_functions_sse2(png_structp pp, unsigned int bpp)
+{
+   if (!png_have_sse2())
+      return;
+
+   /* Up has no dependency between bytes, the compiler handles it fine. */
+   if (bpp == 3)
+   {
+      pp->read_filter[PNG_FILTER_VALUE_SUB-1] = png_read_filter_row_sub3_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_AVG-1] = png_read_filter_row_avg3_sse2;
+   }
+   else if (bpp == 4)
+   {
+      pp->read_filter[PNG_FILTER_VALUE_SUB-1] = png_read_filter_row_sub4_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_AVG-1] = png_read_filter_row_avg4_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_PAETH-1] =
+         png_read_filter_row_paeth4_sse2;
+   }
+}
+#endif /* PNG_READ_SUPPORTED */
+
+#endif /* PNG_INTEL_SSE2_OPT */
@@ -2656,6 +2656,44 @@ PNG_EXPORT(234, void, png_set_check_for_invalid_index, (png_structp png_ptr,
     int allowed));
 #endif
 
+#ifdef PNG_WRITE_SUPPORTED
+/* If enable is non-zero, the IDAT compressor also tries matches at the
+ * distance of the previous pixel and of the pixel above (one row plus the
+ * filter byte back), which zlib's hash chains often miss at low compression
+ * levels.  This helps most on images with flat or repeating areas and costs
+ * a few percent of compression speed.  Needs a zlib with deflateStrides().
+ */
+PNG_EXPORT(235, void, png_set_compression_strides, (png_structp png_ptr,
+    int enable));
+#endif
+
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+/* Filters one row outside of a write struct, for applications that compress
+ * the image data themselves.  'filters' is a mask of PNG_FILTER_* values;
+ * with more than one the row gets the filter png_write_row() would choose
+ * with the default (unweighted) heuristic.  prev_row is the unfiltered
+ * previous row or NULL for the first one, bpp the bytes per complete pixel
+ * (at least 1).  buf must hold 5 * (row_bytes + 1) bytes.  Returns a pointer
+ * into buf to the filter type byte followed by the filtered row.
+ */
+PNG_EXPORT(236, png_bytep, png_filter_row, (int filters, unsigned int bpp,
+    png_size_t row_bytes, png_const_bytep row, png_const_bytep prev_row,
+    png_bytep buf));
+#endif
+
+#ifdef PNG_READ_SUPPORTED
+/* The reverse of png_filter_row(), for applications that inflate the image
+ * data themselves: undoes filter type 'filter' on row (row_bytes bytes, no
+ * filter byte) in place.  prev_row is the unfiltered previous row, all zero
+ * for the first one.  png_ptr must be a read struct that has read IHDR, it
+ * provides the (possibly optimized) filter code for the pixel size.  Returns
+ * 0 for an invalid filter type instead of raising an error.
+ */
+PNG_EXPORT(237, int, png_unfilter_row, (png_structp png_ptr,
+    int filter, png_size_t row_bytes, png_bytep row,
+    png_const_bytep prev_row));
+#endif
+
 /* Maintainer: Put new public prototypes here ^, in libpng.3, and project
  * defs
  */
@@ -2665,7 +2703,7 @@ PNG_EXPORT(234, void, png_set_check_for_invalid_index, (png_structp png_ptr,
  * scripts/symbols.def as well.
  */
 #ifdef PNG_EXPORT_LAST_ORDINAL
-  PNG_EXPORT_LAST_ORDINAL(234);
+  PNG_EXPORT_LAST_ORDINAL(237);
 #endif
 
 #ifdef __cplusplus
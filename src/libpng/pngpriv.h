@@ -49,6 +49,39 @@
 
 #define PNGLIB_BUILD /*libpng is being built, not used*/
 
+/* x86 SIMD code in intel/, picked at runtime after a CPUID check.  Define
+ * PNG_INTEL_SSE2_OPT to 0 to build without it.  PNG_SSE2_TARGET lets GCC
+ * compile the SSE2 functions even when the rest of the build must run on
+ * CPUs without SSE2 (32 bit x86).
+ */
+#ifndef PNG_INTEL_SSE2_OPT
+#  if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || \
+      defined(_M_X64) || defined(_M_AMD64)
+#    define PNG_INTEL_SSE2_OPT 1
+#  else
+#    define PNG_INTEL_SSE2_OPT 0
+#  endif
+#endif
+#if PNG_INTEL_SSE2_OPT > 0
+#  if defined(__GNUC__) && !defined(__SSE2__)
+#    define PNG_SSE2_TARGET __attribute__((target("sse2")))
+#  else
+#    define PNG_SSE2_TARGET
+#  endif
+#  ifndef PNG_FILTER_OPTIMIZATIONS
+#    define PNG_FILTER_OPTIMIZATIONS png_init_filter_functions_sse2
+#  endif
+#  ifndef PNG_WRITE_FILTER_OPTIMIZATIONS
+#    define PNG_WRITE_FILTER_OPTIMIZATIONS png_write_find_filter_sse2
+#  endif
+#  ifndef PNG_FILTER_ROW_OPTIMIZATIONS
+#    define PNG_FILTER_ROW_OPTIMIZATIONS png_filter_row_sse2
+#  endif
+#  ifndef PNG_EXPAND_OPTIMIZATIONS
+#    define PNG_EXPAND_OPTIMIZATIONS png_do_expand_sse2
+#  endif
+#endif
+
 #ifdef PNG_USER_CONFIG
 #  include "pngusr.h"
    /* These should have been defined in pngusr.h */
@@ -1009,6 +1042,32 @@ PNG_EXTERN void png_read_filter_row_paeth3_neon PNGARG((png_row_infop row_info,
 PNG_EXTERN void png_read_filter_row_paeth4_neon PNGARG((png_row_infop row_info,
     png_bytep row, png_const_bytep prev_row));
 
+#if PNG_INTEL_SSE2_OPT > 0
+/* intel/intel_init.c, intel/filter_sse2_intrinsics.c,
+ * intel/expand_sse2_intrinsics.c
+ */
+PNG_EXTERN int png_have_sse2 PNGARG((void));
+PNG_EXTERN void png_init_filter_functions_sse2 PNGARG((png_structp pp,
+    unsigned int bpp));
+PNG_EXTERN void png_read_filter_row_sub3_sse2 PNGARG((png_row_infop row_info,
+    png_bytep row, png_const_bytep prev_row));
+PNG_EXTERN void png_read_filter_row_sub4_sse2 PNGARG((png_row_infop row_info,
+    png_bytep row, png_const_bytep prev_row));
+PNG_EXTERN void png_read_filter_row_avg3_sse2 PNGARG((png_row_infop row_info,
+    png_bytep row, png_const_bytep prev_row));
+PNG_EXTERN void png_read_filter_row_avg4_sse2 PNGARG((png_row_infop row_info,
+    png_bytep row, png_const_bytep prev_row));
+PNG_EXTERN void png_read_filter_row_paeth4_sse2 PNGARG((png_row_infop row_info,
+    png_bytep row, png_const_bytep prev_row));
+PNG_EXTERN int png_filter_row_sse2 PNGARG((png_const_bytep row,
+    png_const_bytep prev, png_bytep *out, png_size_t row_bytes,
+    unsigned int bpp, unsigned int filters));
+PNG_EXTERN png_bytep png_write_find_filter_sse2 PNGARG((png_structp png_ptr,
+    png_size_t row_bytes, unsigned int bpp, unsigned int filters));
+PNG_EXTERN int png_do_expand_sse2 PNGARG((png_row_infop row_info,
+    png_bytep row, png_const_color_16p trans_color));
+#endif
+
 /* Choose the best filter to use and filter the row data */
 PNG_EXTERN void png_write_find_filter PNGARG((png_structp png_ptr,
     png_row_infop row_info));
@@ -1150,7 +1209,7 @@ PNG_EXTERN void png_do_encode_alpha PNGARG((png_row_infop row_info,
 #ifdef PNG_READ_EXPAND_SUPPORTED
 PNG_EXTERN void png_do_expand_palette PNGARG((png_row_infop row_info,
     png_bytep row, png_const_colorp palette, png_const_bytep trans,
-    int num_trans));
+    int num_trans, png_const_bytep palette_rgba));
 PNG_EXTERN void png_do_expand PNGARG((png_row_infop row_info,
     png_bytep row, png_const_color_16p trans_color));
 #endif
@@ -1050,6 +1050,10 @@ png_read_destroy(png_structp png_ptr, png_infop info_ptr,
    png_free(png_ptr, png_ptr->quantize_index);
 #endif
 
+#ifdef PNG_READ_EXPAND_SUPPORTED
+   png_free(png_ptr, png_ptr->palette_rgba);
+#endif
+
    if (png_ptr->free_me & PNG_FREE_PLTE)
       png_zfree(png_ptr, png_ptr->palette);
    png_ptr->free_me &= ~PNG_FREE_PLTE;
@@ -1870,6 +1870,40 @@ png_init_read_transformations(png_structp png_ptr)
       }
    }
 #endif  /* PNG_READ_SHIFT_SUPPORTED */
+
+#ifdef PNG_READ_EXPAND_SUPPORTED
+   /* The palette is final now; expanding to RGBA becomes a table lookup.
+    * Entries past num_palette are black, as in the zeroed png_ptr->palette,
+    * past num_trans they are opaque.
+    */
+   if ((png_ptr->transformations & PNG_EXPAND) &&
+       png_ptr->color_type == PNG_COLOR_TYPE_PALETTE && png_ptr->num_trans > 0)
+   {
+      int i;
+
+      if (png_ptr->palette_rgba == NULL)
+         png_ptr->palette_rgba = (png_bytep)png_malloc(png_ptr,
+             4 * PNG_MAX_PALETTE_LENGTH);
+
+      for (i = 0; i < PNG_MAX_PALETTE_LENGTH; i++)
+      {
+         png_bytep entry = png_ptr->palette_rgba + 4 * i;
+
+         if (i < png_ptr->num_palette)
+         {
+            entry[0] = png_ptr->palette[i].red;
+            entry[1] = png_ptr->palette[i].green;
+            entry[2] = png_ptr->palette[i].blue;
+         }
+
+         else
+            entry[0] = entry[1] = entry[2] = 0;
+
+         entry[3] = (png_byte)(i < png_ptr->num_trans ?
+             png_ptr->trans_alpha[i] : 0xff);
+      }
+   }
+#endif
 }
 
 /* Modify the info structure to reflect the transformations.  The
@@ -2111,7 +2145,8 @@ png_do_read_transformations(png_structp png_ptr, png_row_infop row_info)
       if (row_info->color_type == PNG_COLOR_TYPE_PALETTE)
       {
          png_do_expand_palette(row_info, png_ptr->row_buf + 1,
-             png_ptr->palette, png_ptr->trans_alpha, png_ptr->num_trans);
+             png_ptr->palette, png_ptr->trans_alpha, png_ptr->num_trans,
+             png_ptr->palette_rgba);
       }
 
       else
@@ -4485,7 +4520,8 @@ png_do_encode_alpha(png_row_infop row_info, png_bytep row, png_structp png_ptr)
  */
 void /* PRIVATE */
 png_do_expand_palette(png_row_infop row_info, png_bytep row,
-   png_const_colorp palette, png_const_bytep trans_alpha, int num_trans)
+   png_const_colorp palette, png_const_bytep trans_alpha, int num_trans,
+   png_const_bytep palette_rgba)
 {
    int shift, value;
    png_bytep sp, dp;
@@ -4584,7 +4620,25 @@ png_do_expand_palette(png_row_infop row_info, png_bytep row,
       if (row_info->bit_depth == 8)
       {
          {
-            if (num_trans > 0)
+            if (num_trans > 0 && palette_rgba != NULL)
+            {
+               /* One 4 byte copy per pixel from the table built by
+                * png_init_read_transformations().
+                */
+               sp = row + (png_size_t)row_width - 1;
+               dp = row + (png_size_t)(row_width << 2) - 4;
+
+               for (i = 0; i < row_width; i++, sp--, dp -= 4)
+                  png_memcpy(dp, palette_rgba + ((png_size_t)*sp << 2), 4);
+
+               row_info->bit_depth = 8;
+               row_info->pixel_depth = 32;
+               row_info->rowbytes = row_width * 4;
+               row_info->color_type = 6;
+               row_info->channels = 4;
+            }
+
+            else if (num_trans > 0)
             {
                sp = row + (png_size_t)row_width - 1;
                dp = row + (png_size_t)(row_width << 2) - 1;
@@ -4647,6 +4701,11 @@ png_do_expand(png_row_infop row_info, png_bytep row,
 
    png_debug(1, "in png_do_expand");
 
+#ifdef PNG_EXPAND_OPTIMIZATIONS
+   if (PNG_EXPAND_OPTIMIZATIONS(row_info, row, trans_color))
+      return;
+#endif
+
    {
       if (row_info->color_type == PNG_COLOR_TYPE_GRAY)
       {
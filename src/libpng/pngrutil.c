@@ -3708,6 +3708,27 @@ png_read_filter_row(png_structp pp, png_row_infop row_info, png_bytep row,
       pp->read_filter[filter-1](row_info, row, prev_row);
 }
 
+int PNGAPI
+png_unfilter_row(png_structp png_ptr, int filter, png_size_t row_bytes,
+   png_bytep row, png_const_bytep prev_row)
+{
+   png_row_info row_info;
+
+   if (png_ptr == NULL || filter < PNG_FILTER_VALUE_NONE ||
+       filter >= PNG_FILTER_VALUE_LAST)
+      return 0;
+
+   row_info.width = png_ptr->width;
+   row_info.rowbytes = row_bytes;
+   row_info.color_type = png_ptr->color_type;
+   row_info.bit_depth = png_ptr->bit_depth;
+   row_info.channels = png_ptr->channels;
+   row_info.pixel_depth = png_ptr->pixel_depth;
+
+   png_read_filter_row(png_ptr, &row_info, row, prev_row, filter);
+   return 1;
+}
+
 #ifdef PNG_SEQUENTIAL_READ_SUPPORTED
 void /* PRIVATE */
 png_read_finish_row(png_structp png_ptr)
@@ -85,6 +85,7 @@ struct png_struct_def
    int zlib_window_bits;      /* holds zlib compression window bits */
    int zlib_mem_level;        /* holds zlib compression memory level */
    int zlib_strategy;         /* holds zlib compression strategy */
+   int zlib_strides;          /* probe pixel/row distances, see deflateStrides */
 #endif
 /* Added at libpng 1.5.4 */
 #if defined(PNG_WRITE_COMPRESSED_TEXT_SUPPORTED) || \
@@ -198,6 +199,10 @@ struct png_struct_def
    png_color_16 trans_color;  /* transparent color for non-paletted files */
 #endif
 
+#ifdef PNG_READ_EXPAND_SUPPORTED
+   png_bytep palette_rgba;    /* palette and tRNS as 256 RGBA entries */
+#endif
+
    png_read_status_ptr read_row_fn;   /* called after each row is decoded */
    png_write_status_ptr write_row_fn; /* called after each row is encoded */
 #ifdef PNG_PROGRESSIVE_READ_SUPPORTED
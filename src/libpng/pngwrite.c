@@ -1471,6 +1471,17 @@ png_set_compression_method(png_structp png_ptr, int method)
    png_ptr->zlib_method = method;
 }
 
+void PNGAPI
+png_set_compression_strides(png_structp png_ptr, int enable)
+{
+   png_debug(1, "in png_set_compression_strides");
+
+   if (png_ptr == NULL)
+      return;
+
+   png_ptr->zlib_strides = enable;
+}
+
 /* The following were added to libpng-1.5.4 */
 #ifdef PNG_WRITE_CUSTOMIZE_ZTXT_COMPRESSION_SUPPORTED
 void PNGAPI
@@ -251,6 +251,16 @@ png_zlib_claim(png_structp png_ptr, png_uint_32 state)
                ret = deflateInit2(&png_ptr->zstream, png_ptr->zlib_level,
                    png_ptr->zlib_method, png_ptr->zlib_window_bits,
                    png_ptr->zlib_mem_level, png_ptr->zlib_strategy);
+
+               /* Only a hint, so a zlib build without it is not an error.
+                * Interlaced passes have shorter rows, the full row length
+                * still fits the last and largest pass.
+                */
+               if (ret == Z_OK && png_ptr->zlib_strides)
+                  (void)deflateStrides(&png_ptr->zstream,
+                      (uInt)((png_ptr->pixel_depth + 7) >> 3),
+                      (uInt)PNG_ROWBYTES(png_ptr->pixel_depth,
+                      png_ptr->width) + 1);
                who = "IDAT";
                break;
 
@@ -2475,6 +2485,27 @@ png_write_find_filter(png_structp png_ptr, png_row_infop row_info)
     *       (i.e., ~ root-mean-square approach)
     */
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   /* Without weights every candidate is scored by its plain sum, which the
+    * optimized code computes for all filters in one pass.  If it did, there
+    * is nothing left to test below.
+    */
+   if ((filter_to_do & (filter_to_do - 1)) != 0
+#ifdef PNG_WRITE_WEIGHTED_FILTER_SUPPORTED
+       && png_ptr->heuristic_method != PNG_FILTER_HEURISTIC_WEIGHTED
+#endif
+      )
+   {
+      png_bytep fast_row = PNG_WRITE_FILTER_OPTIMIZATIONS(png_ptr, row_bytes,
+          bpp, filter_to_do);
+
+      if (fast_row != NULL)
+      {
+         best_row = fast_row;
+         filter_to_do = 0;
+      }
+   }
+#endif
 
    /* We don't need to test the 'no filter' case if this is the only filter
     * that has been chosen, as it doesn't actually do anything to the data.
@@ -3088,6 +3119,141 @@ png_write_find_filter(png_structp png_ptr, png_row_infop row_info)
 }
 
 
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+/* Filters row into out with one filter type and returns the sum of the
+ * filtered bytes taken as signed if 'score' is set, 0 otherwise.
+ */
+static png_uint_32
+png_filter_row_c(int filter, unsigned int bpp, png_size_t row_bytes,
+   png_const_bytep row, png_const_bytep prev_row, png_bytep out, int score)
+{
+   png_size_t i, start = bpp < row_bytes ? bpp : row_bytes;
+   png_uint_32 sum = 0;
+
+   /* Against an all zero previous row Up is None and Paeth is Sub. */
+   if (prev_row == NULL)
+   {
+      if (filter == PNG_FILTER_VALUE_UP)
+         filter = PNG_FILTER_VALUE_NONE;
+
+      else if (filter == PNG_FILTER_VALUE_PAETH)
+         filter = PNG_FILTER_VALUE_SUB;
+   }
+
+   switch (filter)
+   {
+      case PNG_FILTER_VALUE_SUB:
+         png_memcpy(out, row, start);
+         for (i = start; i < row_bytes; i++)
+            out[i] = (png_byte)(row[i] - row[i - bpp]);
+         break;
+
+      case PNG_FILTER_VALUE_UP:
+         for (i = 0; i < row_bytes; i++)
+            out[i] = (png_byte)(row[i] - prev_row[i]);
+         break;
+
+      case PNG_FILTER_VALUE_AVG:
+         if (prev_row == NULL)
+         {
+            png_memcpy(out, row, start);
+            for (i = start; i < row_bytes; i++)
+               out[i] = (png_byte)(row[i] - (row[i - bpp] >> 1));
+            break;
+         }
+
+         for (i = 0; i < start; i++)
+            out[i] = (png_byte)(row[i] - (prev_row[i] >> 1));
+         for (; i < row_bytes; i++)
+            out[i] = (png_byte)(row[i] - ((row[i - bpp] + prev_row[i]) >> 1));
+         break;
+
+      case PNG_FILTER_VALUE_PAETH:
+         for (i = 0; i < start; i++)
+            out[i] = (png_byte)(row[i] - prev_row[i]);
+         for (; i < row_bytes; i++)
+         {
+            int a = row[i - bpp], b = prev_row[i], c = prev_row[i - bpp];
+            int pa = b - c, pb = a - c, pc = pa + pb;
+
+            pa = pa < 0 ? -pa : pa;
+            pb = pb < 0 ? -pb : pb;
+            pc = pc < 0 ? -pc : pc;
+            out[i] = (png_byte)(row[i] -
+               ((pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c));
+         }
+         break;
+
+      default:
+         png_memcpy(out, row, row_bytes);
+         break;
+   }
+
+   if (score)
+   {
+      for (i = 0; i < row_bytes; i++)
+      {
+         int v = out[i];
+
+         sum += (v < 128) ? v : 256 - v;
+      }
+   }
+
+   return sum;
+}
+
+png_bytep PNGAPI
+png_filter_row(int filters, unsigned int bpp, png_size_t row_bytes,
+   png_const_bytep row, png_const_bytep prev_row, png_bytep buf)
+{
+   png_bytep out[PNG_FILTER_VALUE_LAST];
+   png_uint_32 mins = PNG_MAXSUM;
+   int f, best = -1, choice;
+
+   filters &= PNG_ALL_FILTERS;
+   if (filters == 0)
+      filters = PNG_FILTER_NONE;
+   choice = (filters & (filters - 1)) != 0;
+
+   for (f = 0; f < PNG_FILTER_VALUE_LAST; f++)
+   {
+      out[f] = buf + (png_size_t)f * (row_bytes + 1);
+      out[f][0] = (png_byte)f;
+      ++out[f];
+   }
+
+#ifdef PNG_FILTER_ROW_OPTIMIZATIONS
+   if (choice)
+      best = PNG_FILTER_ROW_OPTIMIZATIONS(row, prev_row, out, row_bytes, bpp,
+          (unsigned int)filters);
+#endif
+
+   if (best < 0)
+   {
+      for (f = 0; f < PNG_FILTER_VALUE_LAST; f++)
+      {
+         png_uint_32 sum;
+
+         if (!(filters & (PNG_FILTER_NONE << f)))
+            continue;
+
+         sum = png_filter_row_c(f, bpp, row_bytes, row, prev_row, out[f],
+             choice);
+         if (best < 0 || sum < mins)
+         {
+            mins = sum;
+            best = f;
+         }
+      }
+   }
+
+   else if (best == PNG_FILTER_VALUE_NONE)
+      png_memcpy(out[PNG_FILTER_VALUE_NONE], row, row_bytes);
+
+   return out[best] - 1;
+}
+#endif /* PNG_WRITE_FILTER_SUPPORTED */
+
 /* Do the actual writing of a previously filtered row. */
 static void
 png_write_filtered_row(png_structp png_ptr, png_bytep filtered_row,
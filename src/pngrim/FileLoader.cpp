@@ -0,0 +1,157 @@
+
+/* This code is released into the public domain. */
+
+#include <stdio.h>
+#include "FileLoader.h"
+
+#ifndef _WIN32
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+FileLoader::FileLoader(unsigned threads, unsigned window)
+: m_numThreads(threads ? threads : 1), m_window(window ? window : 1)
+, m_inFlight(0), m_reading(0), m_finished(false), m_quit(false)
+{
+	m_threads = new Thread[m_numThreads];
+	for(unsigned i = 0; i < m_numThreads; ++i)
+		m_threads[i].start(_ioThread, this);
+}
+
+FileLoader::~FileLoader()
+{
+	{
+		MutexLock lock(m_mtx);
+		m_quit = true;
+		m_workCV.broadcast();
+	}
+	delete [] m_threads;
+	for(size_t i = 0; i < m_done.size(); ++i)
+		delete m_done[i];
+}
+
+void FileLoader::add(const char *fn)
+{
+	MutexLock lock(m_mtx);
+	m_pending.push_back(fn);
+	m_workCV.signal();
+}
+
+void FileLoader::finish()
+{
+	MutexLock lock(m_mtx);
+	m_finished = true;
+	m_doneCV.broadcast();
+}
+
+LoadedFile *FileLoader::next()
+{
+	MutexLock lock(m_mtx);
+	while(m_done.empty())
+	{
+		if(m_finished && m_pending.empty() && !m_reading)
+			return NULL;
+		m_doneCV.wait(m_mtx);
+	}
+	LoadedFile *f = m_done.front();
+	m_done.pop_front();
+	return f;
+}
+
+void FileLoader::release(LoadedFile *f)
+{
+	delete f;
+	MutexLock lock(m_mtx);
+	--m_inFlight;
+	m_workCV.signal();
+}
+
+void FileLoader::_ioThread(void *self)
+{
+	((FileLoader*)self)->_ioLoop();
+}
+
+void FileLoader::_ioLoop()
+{
+	m_mtx.lock();
+	for(;;)
+	{
+		while(!m_quit && (m_pending.empty() || m_inFlight >= m_window))
+			m_workCV.wait(m_mtx);
+		if(m_quit)
+			break;
+
+		LoadedFile *f = new LoadedFile;
+		f->name = m_pending.front();
+		m_pending.pop_front();
+		++m_inFlight;
+		++m_reading;
+		m_mtx.unlock();
+
+		f->ok = readFile(f->name.c_str(), f->data);
+
+		m_mtx.lock();
+		--m_reading;
+		m_done.push_back(f);
+		m_doneCV.broadcast();
+	}
+	m_mtx.unlock();
+}
+
+bool FileLoader::readFile(const char *fn, std::vector<unsigned char>& out)
+{
+	out.clear();
+#ifdef _WIN32
+	FILE *fp = fopen(fn, "rb");
+	if(!fp)
+		return false;
+	setvbuf(fp, NULL, _IONBF, 0);
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	bool ok = size >= 0;
+	if(ok && size)
+	{
+		out.resize(size);
+		ok = fread(&out[0], 1, size, fp) == (size_t)size;
+	}
+	fclose(fp);
+	return ok;
+#else
+	int fd = open(fn, O_RDONLY);
+	if(fd < 0)
+		return false;
+	struct stat st;
+	bool ok = !fstat(fd, &st) && S_ISREG(st.st_mode);
+	if(ok && st.st_size)
+	{
+		out.resize(st.st_size);
+		size_t pos = 0;
+		while(pos < out.size())
+		{
+			ssize_t r = pread(fd, &out[pos], out.size() - pos, pos);
+			if(r <= 0)
+			{
+				ok = false;
+				break;
+			}
+			pos += r;
+		}
+	}
+	close(fd);
+	return ok;
+#endif
+}
+
+bool FileLoader::writeFile(const char *fn, const std::vector<unsigned char>& data)
+{
+	FILE *fp = fopen(fn, "wb");
+	if(!fp)
+		return false;
+	bool ok = data.empty() || fwrite(&data[0], 1, data.size(), fp) == data.size();
+	if(fclose(fp))
+		ok = false;
+	return ok;
+}
@@ -0,0 +1,59 @@
+
+/* This code is released into the public domain. */
+
+#ifndef FILELOADER_H
+#define FILELOADER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include "Thread.h"
+
+struct LoadedFile
+{
+	std::string name;
+	std::vector<unsigned char> data;
+	bool ok;
+};
+
+// Reads whole files into memory on a small pool of I/O threads, ahead of
+// the consumer. Sprite sets are mostly tiny files where open/read latency
+// dominates the actual decode, so keeping many reads in flight hides it.
+// At most 'window' files are held in memory at any time; a slot is freed
+// when the consumer calls release().
+class FileLoader
+{
+public:
+	FileLoader(unsigned threads, unsigned window);
+	~FileLoader();
+
+	void add(const char *fn);
+	void finish(); // no more add() calls will follow
+
+	// Blocks until a file is loaded (in completion order).
+	// Returns NULL once all added files were handed out after finish().
+	LoadedFile *next();
+	void release(LoadedFile *f);
+
+	// Synchronous whole-file read, used by the single-file paths too.
+	static bool readFile(const char *fn, std::vector<unsigned char>& out);
+	static bool writeFile(const char *fn, const std::vector<unsigned char>& data);
+
+private:
+	static void _ioThread(void *self);
+	void _ioLoop();
+
+	Thread *m_threads;
+	unsigned m_numThreads;
+	unsigned m_window;
+	unsigned m_inFlight; // loading or loaded, not yet released
+	unsigned m_reading;
+	bool m_finished;
+	bool m_quit;
+	std::deque<std::string> m_pending;
+	std::deque<LoadedFile*> m_done;
+	Mutex m_mtx;
+	CondVar m_workCV, m_doneCV;
+};
+
+#endif
@@ -0,0 +1,221 @@
+
+/* This code is released into the public domain. */
+
+#include <stdio.h>
+#include <ctype.h>
+#include <vector>
+#include "FileScanner.h"
+
+#ifdef _WIN32
+#  include <windows.h>
+#  include <io.h>
+#  include <fcntl.h>
+#else
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <dirent.h>
+#endif
+
+class ScanDirJob : public Job
+{
+	FileScanner& m_scanner;
+	std::string m_dir;
+public:
+	ScanDirJob(FileScanner& s, const std::string& dir) : m_scanner(s), m_dir(dir) {}
+	virtual void run() { m_scanner._scanDir(m_dir); m_scanner._jobDone(); }
+};
+
+class ScanListJob : public Job
+{
+	FileScanner& m_scanner;
+	std::string m_list;
+public:
+	ScanListJob(FileScanner& s, const std::string& list) : m_scanner(s), m_list(list) {}
+	virtual void run() { m_scanner._scanList(m_list); m_scanner._jobDone(); }
+};
+
+
+FileScanner::FileScanner(ThreadPool& pool, FileFunc found, DoneFunc done, void *user)
+: m_pool(pool), m_found(found), m_done(done), m_user(user)
+, m_pattern("*.png"), m_outstanding(0), m_closed(false)
+{
+}
+
+void FileScanner::addDir(const char *dir)
+{
+	{
+		MutexLock lock(m_mtx);
+		++m_outstanding;
+	}
+	m_pool.add(new ScanDirJob(*this, dir));
+}
+
+void FileScanner::addList(const char *list)
+{
+	{
+		MutexLock lock(m_mtx);
+		++m_outstanding;
+	}
+	m_pool.add(new ScanListJob(*this, list));
+}
+
+void FileScanner::close()
+{
+	bool done;
+	{
+		MutexLock lock(m_mtx);
+		m_closed = true;
+		done = !m_outstanding;
+	}
+	if(done)
+		m_done(m_user);
+}
+
+void FileScanner::_jobDone()
+{
+	bool done;
+	{
+		MutexLock lock(m_mtx);
+		done = !--m_outstanding && m_closed;
+	}
+	if(done)
+		m_done(m_user);
+}
+
+void FileScanner::_scanDir(const std::string& dir)
+{
+	std::string prefix = dir;
+	if(!prefix.empty() && prefix[prefix.size() - 1] != '/'
+#ifdef _WIN32
+		&& prefix[prefix.size() - 1] != '\\'
+#endif
+	)
+		prefix += '/';
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA fd;
+	HANDLE h = FindFirstFileA((prefix + "*").c_str(), &fd);
+	if(h == INVALID_HANDLE_VALUE)
+	{
+		printf("Can't read directory %s\n", dir.c_str());
+		return;
+	}
+	do
+	{
+		const char *name = fd.cFileName;
+		if(name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+			continue;
+		if(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			if(!(fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+				addDir((prefix + name).c_str());
+		}
+		else if(globMatch(m_pattern.c_str(), name))
+			m_found((prefix + name).c_str(), m_user);
+	}
+	while(FindNextFileA(h, &fd));
+	FindClose(h);
+#else
+	DIR *d = opendir(dir.c_str());
+	if(!d)
+	{
+		printf("Can't read directory %s\n", dir.c_str());
+		return;
+	}
+	while(struct dirent *e = readdir(d))
+	{
+		const char *name = e->d_name;
+		if(name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+			continue;
+		const std::string path = prefix + name;
+		bool isDir = e->d_type == DT_DIR;
+		bool isFile = e->d_type == DT_REG;
+		if(e->d_type == DT_UNKNOWN || e->d_type == DT_LNK)
+		{
+			// Follow links to files, but don't descend into linked directories
+			// so that link cycles can't make the walk run forever.
+			struct stat st;
+			if(stat(path.c_str(), &st))
+				continue;
+			isDir = e->d_type == DT_UNKNOWN && S_ISDIR(st.st_mode);
+			isFile = S_ISREG(st.st_mode);
+		}
+		if(isDir)
+			addDir(path.c_str());
+		else if(isFile && globMatch(m_pattern.c_str(), name))
+			m_found(path.c_str(), m_user);
+	}
+	closedir(d);
+#endif
+}
+
+void FileScanner::_scanList(const std::string& list)
+{
+	const bool useStdin = list == "-";
+	FILE *fp = useStdin ? stdin : fopen(list.c_str(), "rb");
+	if(!fp)
+	{
+		printf("Can't open file list %s\n", list.c_str());
+		return;
+	}
+
+#ifdef _WIN32
+	if(useStdin)
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+
+	std::string name;
+	std::vector<char> buf(64 * 1024);
+	size_t n;
+	while((n = fread(&buf[0], 1, buf.size(), fp)) > 0)
+	{
+		for(size_t i = 0; i < n; ++i)
+		{
+			if(buf[i])
+				name += buf[i];
+			else if(!name.empty())
+			{
+				m_found(name.c_str(), m_user);
+				name.clear();
+			}
+		}
+	}
+	if(!name.empty())
+		m_found(name.c_str(), m_user);
+
+	if(!useStdin)
+		fclose(fp);
+}
+
+bool FileScanner::globMatch(const char *pat, const char *str)
+{
+	const char *starPat = NULL, *starStr = NULL;
+	while(*str)
+	{
+#ifdef _WIN32
+		const bool same = tolower((unsigned char)*pat) == tolower((unsigned char)*str);
+#else
+		const bool same = *pat == *str;
+#endif
+		if(*pat == '*')
+		{
+			starPat = ++pat;
+			starStr = str;
+		}
+		else if(*pat == '?' || (*pat && same))
+		{
+			++pat;
+			++str;
+		}
+		else if(starPat)
+		{
+			pat = starPat;
+			str = ++starStr;
+		}
+		else
+			return false;
+	}
+	while(*pat == '*')
+		++pat;
+	return !*pat;
+}
@@ -0,0 +1,52 @@
+
+/* This code is released into the public domain. */
+
+#ifndef FILESCANNER_H
+#define FILESCANNER_H
+
+#include <string>
+#include "ThreadPool.h"
+
+// Collects input file names from directory trees and file lists.
+// All traversal runs as jobs on the given pool, so found files can be
+// handed on (and processed) while the walk is still in progress.
+// Subdirectories are walked in parallel.
+class FileScanner
+{
+public:
+	typedef void (*FileFunc)(const char *path, void *user);
+	typedef void (*DoneFunc)(void *user);
+
+	// 'found' is called for every file (possibly from several threads at once),
+	// 'done' exactly once after close() when all scanning has finished.
+	FileScanner(ThreadPool& pool, FileFunc found, DoneFunc done, void *user);
+
+	// Only files whose name matches this glob are reported by addDir().
+	// Supports '*' and '?'. Default is "*.png".
+	void setPattern(const char *glob) { m_pattern = glob; }
+
+	void addDir(const char *dir);   // recursive
+	void addList(const char *list); // NUL-separated file names; "-" is stdin
+	void close(); // no more add*() calls will follow
+
+	static bool globMatch(const char *pat, const char *str);
+
+private:
+	friend class ScanDirJob;
+	friend class ScanListJob;
+
+	void _scanDir(const std::string& dir);
+	void _scanList(const std::string& list);
+	void _jobDone();
+
+	ThreadPool& m_pool;
+	FileFunc m_found;
+	DoneFunc m_done;
+	void *m_user;
+	std::string m_pattern;
+	unsigned m_outstanding;
+	bool m_closed;
+	Mutex m_mtx;
+};
+
+#endif
@@ -23,35 +23,422 @@
 
 #include "ImagePNG.h"
 
+#include <string.h>
 #include <png.h>
+#include <zlib.h>
+#include "FileLoader.h"
+#include "PixelTraits.h"
+#include "PNGWriter.h"
+#include "Thread.h"
+#include "Timer.h"
 
-//////////////////////////////////////////////////////////////////////////
+namespace {
+
+struct MemReader
+{
+	const png_byte *ptr;
+	size_t left;
+};
+
+void readMemCallback(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+	MemReader *rd = (MemReader*)png_get_io_ptr(png_ptr);
+	if(length > rd->left)
+		png_error(png_ptr, "Read past end of data");
+	memcpy(data, rd->ptr, length);
+	rd->ptr += length;
+	rd->left -= length;
+}
+
+// Palette images, tRNS and greyscale below 8 bit come out as 8 bit RGBA or
+// grey + alpha (png_set_expand() does all three). Call before
+// png_read_update_info().
+void setReadTransforms(png_structp png_ptr, png_infop info_ptr, Image& img)
+{
+	const int colorType = png_get_color_type(png_ptr, info_ptr);
+	if(colorType == PNG_COLOR_TYPE_PALETTE || png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS) ||
+	   png_get_bit_depth(png_ptr, info_ptr) < 8)
+		png_set_expand(png_ptr);
+	img.setPaletted(colorType == PNG_COLOR_TYPE_PALETTE);
+}
+
+// Image format for the decoded rows (after png_read_update_info()).
+// Only images with alpha are processed.
+bool imageFormat(png_structp png_ptr, png_infop info_ptr, PixelFormat& format)
+{
+	const unsigned channels = png_get_channels(png_ptr, info_ptr);
+	const unsigned depth = png_get_bit_depth(png_ptr, info_ptr);
+	if(depth != 8 && depth != 16)
+	{
+		printf("Unsupported bit depth: %u\n", depth);
+		return false;
+	}
+	switch(channels)
+	{
+		case 4:
+			format = depth == 16 ? PIXEL_RGBA16 : PIXEL_RGBA8;
+			return true;
+		case 2:
+			format = depth == 16 ? PIXEL_GA16 : PIXEL_GA8;
+			return true;
+		case 3:
+		case 1:
+			printf("File is PNG without alpha, nothing to change.\n");
+			return false;
+		default:
+			printf("Unsupported channel count: %u\n", channels);
+			return false;
+	}
+}
+
+template<class T> void loadPixels(typename T::Pixel *dst, const png_byte *b, unsigned int w)
+{
+	for(unsigned int x = 0; x < w; x++, b += T::channels * T::bytes)
+		dst[x] = T::load(b);
+}
+
+template<class T> void storePixels(const typename T::Pixel *src, size_t n, png_byte *b)
+{
+	for(size_t i = 0; i < n; i++, b += T::channels * T::bytes)
+		T::store(src[i], b);
+}
+
+// One decoded row into row y of img, in img's format
+void unpackRow(Image& img, unsigned int y, const png_byte *b)
+{
+	const size_t offset = (size_t)y * img.width();
+	switch(img.format())
+	{
+		case PIXEL_RGBA8:
+			loadPixels<RGBA8Traits>(img.pixels<unsigned int>() + offset, b, img.width());
+			break;
+		case PIXEL_GA8:
+			loadPixels<GA8Traits>(img.pixels<unsigned short>() + offset, b, img.width());
+			break;
+		case PIXEL_RGBA16:
+			loadPixels<RGBA16Traits>(img.pixels<unsigned long long>() + offset, b, img.width());
+			break;
+		case PIXEL_GA16:
+			loadPixels<GA16Traits>(img.pixels<unsigned int>() + offset, b, img.width());
+			break;
+	}
+}
+
+struct ProgressiveState
+{
+	Image *img;
+	RowListener *listener;
+	unsigned int rows;
+	bool haveInfo;
+	bool unsupported;
+};
+
+void progressiveInfo(png_structp png_ptr, png_infop info_ptr)
+{
+	ProgressiveState *st = (ProgressiveState*)png_get_progressive_ptr(png_ptr);
+	PixelFormat format;
+	setReadTransforms(png_ptr, info_ptr, *st->img);
+	png_read_update_info(png_ptr, info_ptr);
+	if(!imageFormat(png_ptr, info_ptr, format))
+	{
+		st->unsupported = true;
+		png_longjmp(png_ptr, 1);
+	}
+	st->img->resize(png_get_image_width(png_ptr, info_ptr), png_get_image_height(png_ptr, info_ptr), format);
+	st->haveInfo = true;
+	if(st->listener)
+		st->listener->begin(*st->img);
+}
+
+void progressiveRow(png_structp png_ptr, png_bytep new_row, png_uint_32 row_num, int)
+{
+	ProgressiveState *st = (ProgressiveState*)png_get_progressive_ptr(png_ptr);
+	if(!new_row || row_num >= st->img->height())
+		return;
+	unpackRow(*st->img, row_num, new_row);
+	++st->rows;
+	if(st->listener)
+		st->listener->rows(*st->img, row_num, row_num + 1);
+}
+
+// Non-interlaced RGBA and grey + alpha images need none of libpng's
+// transforms, so readPNG() inflates their IDAT data itself in batches of
+// about DIRECT_BATCH_BYTES and unfilters each batch in place, straight into
+// the Image. Images with at least DIRECT_THREADED_MIN_PIXELS pixels do the
+// unfiltering on a second thread (PNGReadParams::threads), which the
+// inflating thread runs at most DIRECT_BATCHES batches ahead of.
+const size_t DIRECT_BATCH_BYTES = 64 * 1024;
+const unsigned DIRECT_BATCHES = 8;
+const unsigned DIRECT_THREADED_MIN_PIXELS = 512 * 512;
+
+unsigned loadU32(const png_byte *p)
+{
+	return ((unsigned)p[0] << 24) | ((unsigned)p[1] << 16) | ((unsigned)p[2] << 8) | p[3];
+}
+
+// Raw, still filtered rows (filter byte first) in a ring buffer, written by
+// the inflating thread and unfiltered into the Image by unfilterRows().
+struct DecodePipe
+{
+	png_structp png_ptr; // only for png_unfilter_row()
+	Image *img;
+	RowListener *listener;
+	size_t stride;
+	unsigned ringRows;
+	std::vector<png_byte> ring;
+	std::vector<png_byte> zero; // previous row of the first one
+	png_const_bytep prev;       // last unfiltered row
+
+	unsigned inflated; // rows [0, inflated) are in the ring
+	unsigned released; // slots of rows [0, released) may be reused
+	unsigned done;     // rows [0, done) are in img
+	bool stop;         // inflating failed
+	bool bad;          // unfiltering failed
+	Mutex mtx;
+	CondVar rowsReady, slotsFree;
+
+	png_bytep slot(unsigned y) { return &ring[(size_t)(y % ringRows) * stride]; }
+};
+
+// Unfilters rows [y0, y1) in their slots and stores them in the image;
+// returns the first row that could not be unfiltered (y1 if none).
+unsigned unfilterRows(DecodePipe& dp, unsigned y0, unsigned y1)
+{
+	const size_t rowBytes = dp.stride - 1;
+	unsigned y = y0;
+	for(; y < y1; ++y)
+	{
+		png_bytep row = dp.slot(y);
+		if(!png_unfilter_row(dp.png_ptr, row[0], rowBytes, row + 1, dp.prev))
+			break;
+		unpackRow(*dp.img, y, row + 1);
+		dp.prev = row + 1;
+	}
+	if(y > y0 && dp.listener)
+		dp.listener->rows(*dp.img, y0, y);
+	return y;
+}
+
+void unfilterThread(void *p)
+{
+	DecodePipe& dp = *(DecodePipe*)p;
+	const unsigned h = dp.img->height();
+
+	MutexLock lock(dp.mtx);
+	while(dp.done < h)
+	{
+		while(!dp.stop && dp.inflated == dp.done)
+			dp.rowsReady.wait(dp.mtx);
+		const unsigned y0 = dp.done, y1 = dp.inflated;
+		if(y0 == y1)
+			break;
+		dp.mtx.unlock();
+		const unsigned y = unfilterRows(dp, y0, y1);
+		dp.mtx.lock();
+		dp.done = y;
+		// The last row is still needed as the previous one
+		dp.released = y - 1;
+		dp.bad = y < y1;
+		dp.slotsFree.signal();
+		if(dp.bad)
+			break;
+	}
+}
+
+// Feeds the IDAT chunks starting at p (a chunk header) to a zlib stream.
+struct IDATInput
+{
+	const png_byte *p, *end;
+	bool checkCRC;
+
+	// Next chunk's data into z; false at the end of the IDATs or on a bad chunk
+	bool next(z_stream& z)
+	{
+		while(end - p >= 12)
+		{
+			const size_t len = loadU32(p);
+			if(memcmp(p + 4, "IDAT", 4) || len > (size_t)(end - p) - 12)
+				return false;
+			const png_byte *data = p + 8;
+			if(checkCRC && crc32(crc32(0L, p + 4, 4), data, (uInt)len) != loadU32(data + len))
+			{
+				printf("[read_png_file] IDAT: CRC error\n");
+				return false;
+			}
+			p = data + len + 4;
+			if(len)
+			{
+				z.next_in = (Bytef*)data;
+				z.avail_in = (uInt)len;
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+// Up to 256 distinct RGBA colors, hashed, for writing a palette
+class ColorTable
+{
+public:
+	ColorTable() : m_size(0) { memset(m_slot, 0xff, sizeof(m_slot)); }
+
+	unsigned size() const { return m_size; }
+	unsigned int color(unsigned i) const { return m_colors[i]; }
+
+	// Index of v, which is added if it's new; -1 if the table is full
+	int add(unsigned int v)
+	{
+		unsigned h = (v * 2654435761u) >> (32 - HASH_BITS);
+		for(; m_slot[h] >= 0; h = (h + 1) & (HASH_SIZE - 1))
+			if(m_colors[m_slot[h]] == v)
+				return m_slot[h];
+		if(m_size == 256)
+			return -1;
+		m_colors[m_size] = v;
+		m_slot[h] = (short)m_size;
+		return m_size++;
+	}
+
+	// Moves the colors with alpha < 255 to the front, so that tRNS can
+	// stop after them; returns how many there are.
+	unsigned transparentFirst()
+	{
+		unsigned int sorted[256];
+		short index[256];
+		unsigned n = 0;
+		for(int pass = 0; pass < 2; ++pass)
+			for(unsigned i = 0; i < m_size; ++i)
+				if(((m_colors[i] >> 24) == 0xff) == (pass == 1))
+				{
+					index[i] = (short)n;
+					sorted[n++] = m_colors[i];
+				}
+		unsigned numTrans = 0;
+		while(numTrans < m_size && (sorted[numTrans] >> 24) != 0xff)
+			++numTrans;
+		memcpy(m_colors, sorted, m_size * sizeof(sorted[0]));
+		for(unsigned h = 0; h < HASH_SIZE; ++h)
+			if(m_slot[h] >= 0)
+				m_slot[h] = index[m_slot[h]];
+		return numTrans;
+	}
+
+private:
+	enum { HASH_BITS = 10, HASH_SIZE = 1 << HASH_BITS };
+	unsigned int m_colors[256];
+	short m_slot[HASH_SIZE]; // index into m_colors, -1 = empty
+	unsigned m_size;
+};
+
+inline bool isGrey(unsigned int v)
+{
+	return (v & 0xff) == ((v >> 8) & 0xff) && (v & 0xff) == ((v >> 16) & 0xff);
+}
+
+// Smallest PNG color type that holds these RGBA pixels exactly: a palette
+// with their colors in 'table', grey + alpha, or RGBA.
+int compactColorType(const unsigned int *px, size_t n, ColorTable& table)
+{
+	bool fits = true, grey = true;
+	for(size_t i = 0; i < n && (fits || grey); ++i)
+	{
+		const unsigned int v = px[i];
+		if(i && v == px[i - 1])
+			continue;
+		grey = grey && isGrey(v);
+		fits = fits && table.add(v) >= 0;
+	}
+	if(fits)
+		return PNG_COLOR_TYPE_PALETTE;
+	return grey ? PNG_COLOR_TYPE_GRAY_ALPHA : PNG_COLOR_TYPE_RGBA;
+}
+
+struct MemWriter
+{
+	std::vector<unsigned char> *out;
+	const PNGWriteParams *params;
+	bool aborted;
+};
 
-Image::Image(unsigned int _width, unsigned int _height)
-: m_width(_width), m_height(_height)
+void writeMemCallback(png_structp png_ptr, png_bytep data, png_size_t length)
 {
-	m_bits.resize(_width * _height);
+	MemWriter *wr = (MemWriter*)png_get_io_ptr(png_ptr);
+	wr->out->insert(wr->out->end(), data, data + length);
+
+	const PNGWriteParams& p = *wr->params;
+	if((p.sizeLimit && wr->out->size() > p.sizeLimit) || (p.deadline && timeMs() > p.deadline))
+	{
+		wr->aborted = true;
+		png_error(png_ptr, "Aborted");
+	}
 }
 
+// Like libpng's default handler, minus the message for deliberate aborts
+void writeErrorCallback(png_structp png_ptr, png_const_charp msg)
+{
+	MemWriter *wr = (MemWriter*)png_get_error_ptr(png_ptr);
+	if(!wr->aborted)
+		fprintf(stderr, "libpng error: %s\n", msg);
+	png_longjmp(png_ptr, 1);
+}
+
+void flushMemCallback(png_structp)
+{
+}
+
+} // end anonymous namespace
 
 //////////////////////////////////////////////////////////////////////////
 
-bool Image::writePNG(const char* aFileName)
+static size_t bytesPerPixel(PixelFormat _format)
 {
-	std::vector<png_byte> byteData (m_bits.size() * 4);
-	std::vector<png_byte>::iterator ptr = byteData.begin();
-	for(std::vector<unsigned int>::const_iterator it = m_bits.begin(); it != m_bits.end(); ++it)
+	switch(_format)
 	{
-		const unsigned int v = *it;
-		*ptr++ = v & 0xff; // R
-		*ptr++ = (v >> 8) & 0xff; // G
-		*ptr++ = (v >> 16) & 0xff; // B
-		*ptr++ = (v >> 24) & 0xff; // A
+		case PIXEL_GA8: return 2;
+		case PIXEL_RGBA16: return 8;
+		default: return 4;
 	}
+}
+
+Image::Image(unsigned int _width, unsigned int _height, PixelFormat _format)
+: m_width(_width), m_height(_height), m_format(_format), m_paletted(false)
+{
+	m_data.resize((size_t)_width * _height * bytesPerPixel(_format));
+}
+
+void Image::resize(unsigned int _width, unsigned int _height, PixelFormat _format)
+{
+	m_width = _width;
+	m_height = _height;
+	m_format = _format;
+	m_data.resize((size_t)_width * _height * bytesPerPixel(_format));
+}
+
+void Image::crop(Image& _out, unsigned int _x, unsigned int _y, unsigned int _width, unsigned int _height) const
+{
+	const size_t bpp = bytesPerPixel(m_format);
+	_out.resize(_width, _height, m_format);
+	for(unsigned int y = 0; y < _height; y++)
+		memcpy(&_out.m_data[(size_t)y * _width * bpp], &m_data[((size_t)(_y + y) * m_width + _x) * bpp], _width * bpp);
+}
+
+void Image::paste(const Image& _src, unsigned int _x, unsigned int _y)
+{
+	const size_t bpp = bytesPerPixel(m_format);
+	for(unsigned int y = 0; y < _src.m_height; y++)
+		memcpy(&m_data[((size_t)(_y + y) * m_width + _x) * bpp], &_src.m_data[(size_t)y * _src.m_width * bpp],
+		       _src.m_width * bpp);
+}
 
-	std::vector<png_byte*> rowData(m_height);
-	for(unsigned int i = 0; i < m_height; i++)
-		rowData[i] = i * m_width * 4 + &byteData.front();
+
+//////////////////////////////////////////////////////////////////////////
+
+bool Image::writePNG(const char* aFileName) const
+{
+	std::vector<unsigned char> fileData;
+	if(!writePNG(fileData))
+		return false;
 
 	/* create file */
 	FILE *fp = fopen(aFileName, "wb");
@@ -60,11 +447,99 @@ bool Image::writePNG(const char* aFileName)
 		return false;
 	}
 
+	bool success = fwrite(&fileData[0], 1, fileData.size(), fp) == fileData.size();
+	if(fclose(fp))
+		success = false;
+	if(!success)
+		printf("[write_png_file] Error writing %s\n", aFileName);
+	return success;
+}
+
+bool Image::writePNG(std::vector<unsigned char>& aOut, const PNGWriteParams& aParams) const
+{
+	const size_t numPixels = (size_t)m_width * m_height;
+	const bool wide = m_format == PIXEL_RGBA16 || m_format == PIXEL_GA16;
+	ColorTable table;
+	int colorType = m_format == PIXEL_GA8 || m_format == PIXEL_GA16 ? PNG_COLOR_TYPE_GRAY_ALPHA : PNG_COLOR_TYPE_RGBA;
+	if(m_format == PIXEL_RGBA8 && m_paletted)
+		colorType = compactColorType(pixels<unsigned int>(), numPixels, table);
+
+	if(m_format == PIXEL_RGBA8 && colorType == PNG_COLOR_TYPE_RGBA &&
+	   (aParams.direct || useBlockWriter(m_width, m_height, aParams.threads)))
+		return writePNGBlocks(pixels<unsigned int>(), m_width, m_height, aParams, aOut);
+
+	int bitDepth = wide ? 16 : 8;
+	unsigned numTrans = 0;
+	png_color palette[256];
+	png_byte trans[256];
+	if(colorType == PNG_COLOR_TYPE_PALETTE)
+	{
+		numTrans = table.transparentFirst();
+		for(unsigned i = 0; i < table.size(); ++i)
+		{
+			const unsigned int v = table.color(i);
+			palette[i].red = v & 0xff;
+			palette[i].green = (v >> 8) & 0xff;
+			palette[i].blue = (v >> 16) & 0xff;
+			trans[i] = (v >> 24) & 0xff;
+		}
+		bitDepth = table.size() <= 2 ? 1 : table.size() <= 4 ? 2 : table.size() <= 16 ? 4 : 8;
+	}
+
+	// One byte per palette index, png_set_packing() takes care of the rest
+	const size_t pixelBytes = (colorType == PNG_COLOR_TYPE_RGBA ? 4 : colorType == PNG_COLOR_TYPE_GRAY_ALPHA ? 2 : 1) *
+	                          (wide ? 2 : 1);
+	std::vector<png_byte> byteData (numPixels * pixelBytes);
+	png_byte *ptr = byteData.empty() ? NULL : &byteData[0];
+	switch(m_format)
+	{
+		case PIXEL_GA8:
+			storePixels<GA8Traits>(pixels<unsigned short>(), numPixels, ptr);
+			break;
+		case PIXEL_RGBA16:
+			storePixels<RGBA16Traits>(pixels<unsigned long long>(), numPixels, ptr);
+			break;
+		case PIXEL_GA16:
+			storePixels<GA16Traits>(pixels<unsigned int>(), numPixels, ptr);
+			break;
+		case PIXEL_RGBA8:
+		{
+			const unsigned int *src = pixels<unsigned int>();
+			if(colorType == PNG_COLOR_TYPE_RGBA)
+			{
+				storePixels<RGBA8Traits>(src, numPixels, ptr);
+				break;
+			}
+			for(size_t i = 0; i < numPixels; ++i)
+			{
+				const unsigned int v = src[i];
+				if(colorType == PNG_COLOR_TYPE_PALETTE)
+					*ptr++ = (png_byte)table.add(v);
+				else
+				{
+					*ptr++ = v & 0xff; // G
+					*ptr++ = (v >> 24) & 0xff; // A
+				}
+			}
+			break;
+		}
+	}
+
+	std::vector<png_byte*> rowData(m_height);
+	for(unsigned int i = 0; i < m_height; i++)
+		rowData[i] = (size_t)i * m_width * pixelBytes + &byteData.front();
+
+	aOut.clear();
 	bool success = true;
+	MemWriter writer;
+	writer.out = &aOut;
+	writer.params = &aParams;
+	writer.aborted = false;
 
 	/* initialize stuff */
+	png_infop info_ptr = 0;
 	png_structp png_ptr;
-	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, &writer, writeErrorCallback, NULL);
 
 	if (!png_ptr) {
 		printf("[write_png_file] png_create_write_struct failed\n");
@@ -72,7 +547,6 @@ bool Image::writePNG(const char* aFileName)
 		goto end;
 	}
 
-	png_infop info_ptr;
 	info_ptr = png_create_info_struct(png_ptr);
 	if (!info_ptr) {
 		printf("[write_png_file] png_create_info_struct failed\n");
@@ -87,24 +561,41 @@ bool Image::writePNG(const char* aFileName)
 	}
 
 
-	png_init_io(png_ptr, fp);
+	png_set_write_fn(png_ptr, &writer, writeMemCallback, flushMemCallback);
+
+	if (aParams.filters >= 0)
+		png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, aParams.filters);
+	if (aParams.level >= 0)
+		png_set_compression_level(png_ptr, aParams.level);
+	if (aParams.strategy >= 0)
+		png_set_compression_strategy(png_ptr, aParams.strategy);
+	png_set_compression_strides(png_ptr, aParams.strides);
 
 	/* write header */
 	if (setjmp(png_jmpbuf(png_ptr))) {
-		printf("[write_png_file] Error during writing header\n");
+		if (!writer.aborted)
+			printf("[write_png_file] Error during writing header\n");
 		success = false;
 		goto end;
 	}
 
 	png_set_IHDR(png_ptr, info_ptr, m_width, m_height,
-			8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
+			bitDepth, colorType, PNG_INTERLACE_NONE,
 			PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+	if (colorType == PNG_COLOR_TYPE_PALETTE) {
+		png_set_PLTE(png_ptr, info_ptr, palette, table.size());
+		if (numTrans)
+			png_set_tRNS(png_ptr, info_ptr, trans, numTrans, NULL);
+	}
 
 	png_write_info(png_ptr, info_ptr);
+	if (bitDepth < 8)
+		png_set_packing(png_ptr);
 
 	/* write bytes */
 	if (setjmp(png_jmpbuf(png_ptr))) {
-		printf("[write_png_file] Error during writing bytes\n");
+		if (!writer.aborted)
+			printf("[write_png_file] Error during writing bytes\n");
 		success = false;
 		goto end;
 	}
@@ -114,7 +605,8 @@ bool Image::writePNG(const char* aFileName)
 
 	/* end write */
 	if (setjmp(png_jmpbuf(png_ptr))) {
-		printf("[write_png_file] Error during end of write\n");
+		if (!writer.aborted)
+			printf("[write_png_file] Error during end of write\n");
 		success = false;
 		goto end;
 	}
@@ -122,38 +614,301 @@ bool Image::writePNG(const char* aFileName)
 	png_write_end(png_ptr, NULL);
 
 end:
-	if(fp)
-		fclose(fp);
+	if(png_ptr)
+		png_destroy_write_struct(&png_ptr, info_ptr ? &info_ptr : NULL);
 	return success;
 }
 
 
+
 bool Image::readPNG(const char* aFileName)
 {
-	png_byte header[8];	// 8 is the maximum size that can be checked
-	std::vector<unsigned int>::iterator it;
-	std::vector<png_byte> byteData;
-	std::vector<png_byte*> rowData;
+	std::vector<unsigned char> fileData;
+	if(!FileLoader::readFile(aFileName, fileData))
+	{
+		printf("[read_png_file] File %s could not be opened for reading\n", aFileName);
+		return false;
+	}
+	return readPNG(fileData.empty() ? NULL : &fileData[0], fileData.size(), aFileName);
+}
+
+static void applyReadParams(png_structp png_ptr, const PNGReadParams& aParams)
+{
+	// The input is known to be intact (e.g. we wrote it ourselves), so skip
+	// the CRC work. Ancillary chunks must follow suit: libpng hashes a chunk
+	// type under the rules of the previous chunk, so checking only those
+	// would report bogus errors after every critical chunk.
+	if(aParams.skipCRC)
+		png_set_crc_action(png_ptr, PNG_CRC_QUIET_USE, PNG_CRC_QUIET_USE);
+}
+
+bool Image::readPNG(const unsigned char* aData, size_t aSize, const char* aName, RowListener* aListener,
+                    const PNGReadParams& aParams)
+{
+	/* test for it being a png */
+	if (aSize < 8 || png_sig_cmp((png_bytep)aData, 0, 8))
+	{
+		printf("[read_png_file] File %s is not recognized as a PNG file\n", aName);
+		return false;
+	}
+	m_paletted = false;
+
+	// IHDR must come first, byte 28 is its interlace method.
+	// Interlaced images are only complete after the last pass, so there is
+	// nothing to gain from handing out rows early; decode those in one go.
+	if (aSize > 28 && aData[28] == PNG_INTERLACE_NONE)
+	{
+		// Bytes 24 and 25 are bit depth and color type
+		if ((aData[24] == 8 || aData[24] == 16) &&
+		    (aData[25] == PNG_COLOR_TYPE_RGBA || aData[25] == PNG_COLOR_TYPE_GA))
+			return _readPNGDirect(aData, aSize, aListener, aParams);
+		return _readPNGProgressive(aData, aSize, aListener, aParams);
+	}
+	return _readPNGFull(aData, aSize, aListener, aParams);
+}
+
+bool Image::_readPNGDirect(const unsigned char* aData, size_t aSize, RowListener* aListener,
+                           const PNGReadParams& aParams)
+{
 	png_infop info_ptr = 0;
 	png_structp png_ptr = 0;
-	unsigned char channels = 0;
+	MemReader reader;
+	DecodePipe dp;
+	IDATInput input;
+	z_stream z;
+	Thread unfilter;
+	PixelFormat format;
+	size_t batchRows;
+	unsigned y = 0;
+	int zret = Z_OK;
+	bool zinit = false, threaded = false;
+
+	bool success = true;
 
-	/* open file and test for it being a png */
-	FILE *fp = fopen(aFileName, "rb");
-	if (!fp)
+	/* initialize stuff */
+	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+
+	if (!png_ptr)
 	{
-		printf("[read_png_file] File %s could not be opened for reading\n", aFileName);
-		return false;
+		printf("[read_png_file] png_create_read_struct failed\n");
+		success = false;
+		goto end;
 	}
+
+	info_ptr = png_create_info_struct(png_ptr);
+	if (!info_ptr)
+	{
+		printf("[read_png_file] png_create_info_struct failed\n");
+		success = false;
+		goto end;
+	}
+
+	if (setjmp(png_jmpbuf(png_ptr)))
+	{
+		printf("[read_png_file] Error during init_io\n");
+		success = false;
+		goto end;
+	}
+
+	/* libpng checks the chunks up to the first IDAT, which it stops in */
+	reader.ptr = aData + 8;
+	reader.left = aSize - 8;
+	applyReadParams(png_ptr, aParams);
+	png_set_read_fn(png_ptr, &reader, readMemCallback);
+	png_set_sig_bytes(png_ptr, 8);
+
+	png_read_info(png_ptr, info_ptr);
+
+	if (!imageFormat(png_ptr, info_ptr, format))
+	{
+		success = false;
+		goto end;
+	}
+	if (png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE || reader.ptr - aData < 16)
+	{
+		printf("[read_png_file] Error during read_image\n");
+		success = false;
+		goto end;
+	}
+
+	resize(png_get_image_width(png_ptr, info_ptr), png_get_image_height(png_ptr, info_ptr), format);
+	if(aListener)
+		aListener->begin(*this);
+
+	dp.png_ptr = png_ptr;
+	dp.img = this;
+	dp.listener = aListener;
+	dp.stride = png_get_rowbytes(png_ptr, info_ptr) + 1;
+	batchRows = DIRECT_BATCH_BYTES / dp.stride;
+	if(!batchRows)
+		batchRows = 1;
+	threaded = aParams.threads > 1 && (unsigned long long)m_width * m_height >= DIRECT_THREADED_MIN_PIXELS;
+	// Unfiltering inline keeps only one batch and the row before it
+	dp.ringRows = (unsigned)(batchRows * (threaded ? DIRECT_BATCHES : 1)) + 1;
+	dp.ring.resize(dp.ringRows * dp.stride);
+	dp.zero.assign(dp.stride - 1, 0);
+	dp.prev = &dp.zero[0];
+	dp.inflated = dp.released = dp.done = 0;
+	dp.stop = dp.bad = false;
+
+	/* from here on the raw IDAT data is ours, back to the chunk header */
+	input.p = reader.ptr - 8;
+	input.end = aData + aSize;
+	input.checkCRC = !aParams.skipCRC;
+	memset(&z, 0, sizeof(z));
+	zinit = inflateInit(&z) == Z_OK;
+	if(!zinit || (threaded && !unfilter.start(unfilterThread, &dp)))
+	{
+		printf("[read_png_file] Error during read_image\n");
+		success = false;
+		goto end;
+	}
+
+	/* inflate on this thread, unfilter here or on the other one */
+	while(y < m_height)
+	{
+		unsigned n = (unsigned)batchRows;
+		if(n > m_height - y)
+			n = m_height - y;
+		if(n > dp.ringRows - y % dp.ringRows)
+			n = dp.ringRows - y % dp.ringRows;
+		{
+			MutexLock lock(dp.mtx);
+			while(!dp.bad && y + n > dp.released + dp.ringRows)
+				dp.slotsFree.wait(dp.mtx);
+			if(dp.bad)
+				break;
+		}
+
+		z.next_out = dp.slot(y);
+		z.avail_out = (uInt)(n * dp.stride);
+		while(z.avail_out && (zret == Z_OK || zret == Z_BUF_ERROR))
+		{
+			if(!z.avail_in && !input.next(z))
+				break;
+			zret = inflate(&z, Z_NO_FLUSH);
+		}
+		if(z.avail_out || zret == Z_DATA_ERROR)
+			break;
+
+		if(!threaded)
+		{
+			dp.done = unfilterRows(dp, y, y + n);
+			dp.released = dp.done - 1;
+			dp.bad = dp.done < y + n;
+			y += n;
+			continue;
+		}
+
+		y += n;
+		MutexLock lock(dp.mtx);
+		dp.inflated = y;
+		dp.rowsReady.signal();
+	}
+
+	if(threaded)
+	{
+		{
+			MutexLock lock(dp.mtx);
+			dp.stop = true; // wakes up the unfilter thread if inflating failed
+			dp.rowsReady.signal();
+		}
+		unfilter.join();
+	}
+
+	/* the stream has to end right after the rows, with a valid Adler-32 */
+	while(y == m_height && (zret == Z_OK || zret == Z_BUF_ERROR))
+	{
+		png_byte extra;
+		z.next_out = &extra;
+		z.avail_out = 1;
+		if(!z.avail_in && !input.next(z))
+			break;
+		zret = inflate(&z, Z_NO_FLUSH);
+	}
+
+	if (y < m_height || dp.done < m_height || zret != Z_STREAM_END)
+	{
+		printf("[read_png_file] Error during read_image\n");
+		success = false;
+	}
+
+end:
+	if(zinit)
+		inflateEnd(&z);
+	if(png_ptr)
+		png_destroy_read_struct(&png_ptr, info_ptr ? &info_ptr : NULL, NULL);
+	return success;
+}
+
+bool Image::_readPNGProgressive(const unsigned char* aData, size_t aSize, RowListener* aListener,
+                                const PNGReadParams& aParams)
+{
+	png_infop info_ptr = 0;
+	png_structp png_ptr = 0;
+	ProgressiveState state;
+	state.img = this;
+	state.listener = aListener;
+	state.rows = 0;
+	state.haveInfo = false;
+	state.unsupported = false;
+
 	bool success = true;
-	fread(header, 1, 8, fp);
-	if (png_sig_cmp(header, 0, 8))
+
+	/* initialize stuff */
+	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+
+	if (!png_ptr)
+	{
+		printf("[read_png_file] png_create_read_struct failed\n");
+		success = false;
+		goto end;
+	}
+
+	info_ptr = png_create_info_struct(png_ptr);
+	if (!info_ptr)
+	{
+		printf("[read_png_file] png_create_info_struct failed\n");
+		success = false;
+		goto end;
+	}
+
+	/* read file, rows are delivered as soon as they are inflated */
+	if (setjmp(png_jmpbuf(png_ptr)))
 	{
-		printf("[read_png_file] File %s is not recognized as a PNG file\n", aFileName);
+		if(!state.unsupported)
+			printf("[read_png_file] Error during read_image\n");
 		success = false;
 		goto end;
 	}
 
+	applyReadParams(png_ptr, aParams);
+	png_set_progressive_read_fn(png_ptr, &state, progressiveInfo, progressiveRow, NULL);
+	png_process_data(png_ptr, info_ptr, (png_bytep)aData, aSize);
+
+	if (!state.haveInfo || state.rows < m_height)
+	{
+		printf("[read_png_file] Error during read_image\n");
+		success = false;
+	}
+
+end:
+	if(png_ptr)
+		png_destroy_read_struct(&png_ptr, info_ptr ? &info_ptr : NULL, NULL);
+	return success;
+}
+
+bool Image::_readPNGFull(const unsigned char* aData, size_t aSize, RowListener* aListener,
+                         const PNGReadParams& aParams)
+{
+	std::vector<png_byte> byteData;
+	std::vector<png_byte*> rowData;
+	png_infop info_ptr = 0;
+	png_structp png_ptr = 0;
+	MemReader reader;
+	PixelFormat format;
+
+	bool success = true;
 
 	/* initialize stuff */
 	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
@@ -180,23 +935,29 @@ bool Image::readPNG(const char* aFileName)
 		goto end;
 	}
 
-	png_init_io(png_ptr, fp);
+	reader.ptr = aData + 8;
+	reader.left = aSize - 8;
+	applyReadParams(png_ptr, aParams);
+	png_set_read_fn(png_ptr, &reader, readMemCallback);
 	png_set_sig_bytes(png_ptr, 8);
 
 	png_read_info(png_ptr, info_ptr);
 
-	m_width = png_get_image_width(png_ptr, info_ptr);
-	m_height = png_get_image_height(png_ptr, info_ptr);
-	/*color_type = info_ptr->color_type;
-	bit_depth = info_ptr->bit_depth;*/
-
+	setReadTransforms(png_ptr, info_ptr, *this);
 	png_set_interlace_handling(png_ptr);
 	png_read_update_info(png_ptr, info_ptr);
 
+	if(!imageFormat(png_ptr, info_ptr, format))
+	{
+		success = false;
+		goto end;
+	}
+	resize(png_get_image_width(png_ptr, info_ptr), png_get_image_height(png_ptr, info_ptr), format);
+
 	byteData.resize(png_get_rowbytes(png_ptr, info_ptr) * m_height);
 	rowData.resize(m_height);
 	for(unsigned int i = 0; i < m_height; i++)
-		rowData[i] = i * png_get_rowbytes(png_ptr, info_ptr) + &byteData.front();
+		rowData[i] = (size_t)i * png_get_rowbytes(png_ptr, info_ptr) + &byteData.front();
 
 	/* read file */
 	if (setjmp(png_jmpbuf(png_ptr)))
@@ -208,45 +969,15 @@ bool Image::readPNG(const char* aFileName)
 
 	png_read_image(png_ptr, &rowData.front());
 
-	m_bits.resize(m_width * m_height);
-	it = m_bits.begin();
-	channels = png_get_channels(png_ptr, info_ptr);
-
-	switch(channels)
-	{
-		case 4:
-			break;
-		case 3:
-			printf("File is 24 bit PNG without alpha, nothing to change.\n");
-			success = false;
-			goto end;
-		default: // FIXME: there's also 2 channel PNGs, greyscale + alpha.
-			printf("Unsupported channel count: %u\n", channels);
-			success = false;
-			goto end;
-	}
-
-	for(size_t y = 0; y < m_height; y++)
-	{
-		png_byte *b = rowData[y];
-		for(size_t x = 0; x < m_width; x++)
-		{
-			unsigned int v = 0;
-			v |= *b++; // R
-			v |= *b++ << 8; // G
-			v |= *b++ << 16; // B
-			//if(channels == 4)
-				v |= *b++ << 24; // A
-			//else
-			//	v |= 0xff << 24; // A
-
-			*it++ = v;
-		}
-	}
+	if(aListener)
+		aListener->begin(*this);
+	for(unsigned int y = 0; y < m_height; y++)
+		unpackRow(*this, y, rowData[y]);
+	if(aListener)
+		aListener->rows(*this, 0, m_height);
 
 end:
-	if(fp)
-		fclose(fp);
+	if(png_ptr)
+		png_destroy_read_struct(&png_ptr, info_ptr ? &info_ptr : NULL, NULL);
 	return success;
-
 }
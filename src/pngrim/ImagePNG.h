@@ -24,32 +24,117 @@
 #ifndef IMAGEPNG_H
 #define IMAGEPNG_H
 
+#include <stddef.h>
 #include <vector>
 
+class Image;
+
+// Encoder settings for writePNG(). -1 leaves the libpng default in place
+// (adaptive filtering, zlib level 6, Z_FILTERED).
+struct PNGWriteParams
+{
+	PNGWriteParams() : filters(-1), level(-1), strategy(-1), strides(true), threads(1), direct(false), deadline(0), sizeLimit(0) {}
+
+	int filters;      // PNG_FILTER_* mask
+	int level;        // zlib level, 0-9
+	int strategy;     // Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE, ...
+	bool strides;     // let zlib try the pixel-left/pixel-above distances first
+	unsigned threads; // > 1 deflates large images in parallel blocks (PNGWriter.h)
+	bool direct;      // use writePNGBlocks() for any size and thread count
+	double deadline;  // give up (quietly) once timeMs() passes this, 0 = never
+	size_t sizeLimit; // give up (quietly) once the output gets larger, 0 = never
+};
+
+// Decoder settings for readPNG().
+struct PNGReadParams
+{
+	PNGReadParams() : skipCRC(false), threads(1) {}
+
+	bool skipCRC;     // don't compute or check chunk CRCs
+	unsigned threads; // > 1 inflates and unfilters large RGBA and GA images on two threads
+};
+
+// Receives decoded rows while readPNG() is still running, so that work
+// on the image can overlap with decoding. Called on a decoding thread, one
+// at a time.
+class RowListener
+{
+public:
+	virtual ~RowListener() {}
+	// Size is known and storage allocated, no pixels yet.
+	virtual void begin(const Image& img) = 0;
+	// Rows [y0, y1) are complete. Rows arrive in order, each exactly once.
+	virtual void rows(const Image& img, unsigned int y0, unsigned int y1) = 0;
+};
+
+// Pixel layouts an Image can hold. The channels are packed into one integer
+// per pixel, first channel in the lowest bits, alpha in the highest.
+// PixelTraits.h describes them for code templated on the format.
+enum PixelFormat
+{
+	PIXEL_RGBA8,  // unsigned int, 0xAABBGGRR
+	PIXEL_GA8,    // unsigned short, 0xAAGG (grey + alpha)
+	PIXEL_RGBA16, // unsigned long long, 0xAAAABBBBGGGGRRRR
+	PIXEL_GA16    // unsigned int, 0xAAAAGGGG
+};
+
 class Image
 {
 	unsigned int m_width, m_height;
-	std::vector<unsigned int> m_bits;
+	PixelFormat m_format;
+	bool m_paletted;
+	std::vector<unsigned char> m_data;
 
 public:
-	Image() : m_width(0), m_height(0) {}
-	Image(unsigned int _width, unsigned int _height);
+	Image() : m_width(0), m_height(0), m_format(PIXEL_RGBA8), m_paletted(false) {}
+	Image(unsigned int _width, unsigned int _height, PixelFormat _format = PIXEL_RGBA8);
+
+	void resize(unsigned int _width, unsigned int _height, PixelFormat _format = PIXEL_RGBA8);
 
 	unsigned int width() const {return m_width;}
 	unsigned int height() const {return m_height;}
+	// May not fit in 32 bits; index pixels() with size_t.
+	size_t numPixels() const {return (size_t)m_width * m_height;}
+	PixelFormat format() const {return m_format;}
+
+	// Decoded from a palette image; writePNG() goes back to a palette (or
+	// grey + alpha) if the colors still fit. Set by readPNG().
+	bool paletted() const {return m_paletted;}
+	void setPaletted(bool _paletted) {m_paletted = _paletted;}
+
+	// Row after row, width() pixels each. P must match format(), see
+	// PixelFormat.
+	template<typename P> P* pixels() {return (P*)&m_data[0];}
+	template<typename P> const P* pixels() const {return (const P*)&m_data[0];}
 
-	// 0xAABBGGRR
+	// PIXEL_RGBA8 only, 0xAABBGGRR
 	inline unsigned int& operator() (unsigned int _x, unsigned int _y)
 	{
-		return m_bits[_y * m_width + _x];
+		return pixels<unsigned int>()[(size_t)_y * m_width + _x];
 	}
 	inline unsigned int operator() (unsigned int _x, unsigned int _y) const
 	{
-		return m_bits[_y * m_width + _x];
+		return pixels<unsigned int>()[(size_t)_y * m_width + _x];
 	}
 
-	bool writePNG(const char* _fileName);
+	// _out becomes a copy of the given rectangle, in the same format.
+	void crop(Image& _out, unsigned int _x, unsigned int _y, unsigned int _width, unsigned int _height) const;
+	// Copies all of _src (same format, fits) to (_x, _y). Threads may paste
+	// into disjoint rectangles at the same time.
+	void paste(const Image& _src, unsigned int _x, unsigned int _y);
+
+	bool writePNG(const char* _fileName) const;
+	// Encode to a complete in-memory PNG file.
+	bool writePNG(std::vector<unsigned char>& _out, const PNGWriteParams& _params = PNGWriteParams()) const;
 	bool readPNG(const char* _fileName);
+	// Decode from a complete in-memory PNG file; _name is only used for messages.
+	bool readPNG(const unsigned char* _data, size_t _size, const char* _name, RowListener* _listener = 0,
+	             const PNGReadParams& _params = PNGReadParams());
+
+private:
+	bool _readPNGDirect(const unsigned char* _data, size_t _size, RowListener* _listener, const PNGReadParams& _params);
+	bool _readPNGProgressive(const unsigned char* _data, size_t _size, RowListener* _listener, const PNGReadParams& _params);
+	bool _readPNGFull(const unsigned char* _data, size_t _size, RowListener* _listener, const PNGReadParams& _params);
 };
 
 
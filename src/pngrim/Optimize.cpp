@@ -0,0 +1,191 @@
+
+/* This code is released into the public domain. */
+
+#include <stdio.h>
+#include <png.h>
+#include <zlib.h>
+#include "Optimize.h"
+#include "Thread.h"
+#include "Timer.h"
+
+namespace {
+
+struct ZSettings
+{
+	int level, strategy;
+};
+
+// Most promising first, so that a tight time budget still tries those.
+const int trialFilters[] =
+{
+	PNG_ALL_FILTERS, PNG_FILTER_PAETH, PNG_FILTER_SUB, PNG_FILTER_UP,
+	PNG_FILTER_NONE, PNG_FILTER_AVG
+};
+const ZSettings trialZlib[] =
+{
+	{ 9, Z_FILTERED }, { 9, Z_DEFAULT_STRATEGY }, { 9, Z_RLE },
+	{ 8, Z_FILTERED }, { 7, Z_DEFAULT_STRATEGY }, { 6, Z_DEFAULT_STRATEGY }
+};
+const unsigned numFilters = sizeof(trialFilters) / sizeof(trialFilters[0]);
+const unsigned numZlib = sizeof(trialZlib) / sizeof(trialZlib[0]);
+// Trial 0 is libpng's defaults, then all combinations of the above
+const unsigned numTrials = 1 + numFilters * numZlib;
+
+PNGWriteParams trialParams(unsigned i)
+{
+	PNGWriteParams p;
+	if(i)
+	{
+		--i;
+		p.filters = trialFilters[i % numFilters];
+		p.level = trialZlib[i / numFilters].level;
+		p.strategy = trialZlib[i / numFilters].strategy;
+	}
+	return p;
+}
+
+struct TrialState
+{
+	const Image *img;
+	double deadline;
+	unsigned next;
+	std::vector<unsigned char> best;
+	PNGWriteParams bestParams;
+	size_t defaultSize;
+	unsigned started, cutShort, notRun;
+	Mutex mtx;
+};
+
+void trialThread(void *p)
+{
+	TrialState& st = *(TrialState*)p;
+	std::vector<unsigned char> buf;
+	for(;;)
+	{
+		PNGWriteParams params;
+		unsigned i;
+		{
+			MutexLock lock(st.mtx);
+			if(st.next == numTrials)
+				return;
+			i = st.next++;
+			params = trialParams(i);
+			if(i) // the default trial always completes
+			{
+				if(st.deadline && timeMs() > st.deadline)
+				{
+					st.notRun += numTrials - st.next + 1;
+					st.next = numTrials;
+					return;
+				}
+				params.deadline = st.deadline;
+				params.sizeLimit = st.best.size();
+			}
+		}
+
+		const bool ok = st.img->writePNG(buf, params);
+
+		MutexLock lock(st.mtx);
+		++st.started;
+		if(!ok)
+		{
+			++st.cutShort;
+			continue;
+		}
+		if(!i)
+			st.defaultSize = buf.size();
+		if(st.best.empty() || buf.size() < st.best.size())
+		{
+			st.best.swap(buf);
+			st.bestParams = params;
+			st.bestParams.deadline = 0;
+			st.bestParams.sizeLimit = 0;
+		}
+	}
+}
+
+const char *filterName(int f)
+{
+	switch(f)
+	{
+		case -1:
+		case PNG_ALL_FILTERS: return "adaptive";
+		case PNG_FILTER_NONE: return "none";
+		case PNG_FILTER_SUB: return "sub";
+		case PNG_FILTER_UP: return "up";
+		case PNG_FILTER_AVG: return "avg";
+		case PNG_FILTER_PAETH: return "paeth";
+	}
+	return "mixed";
+}
+
+const char *strategyName(int s)
+{
+	switch(s)
+	{
+		case -1:
+		case Z_FILTERED: return "filtered";
+		case Z_DEFAULT_STRATEGY: return "default";
+		case Z_RLE: return "rle";
+		case Z_HUFFMAN_ONLY: return "huffman";
+		case Z_FIXED: return "fixed";
+	}
+	return "?";
+}
+
+} // end anonymous namespace
+
+std::string OptimizeResult::describe() const
+{
+	char buf[160];
+	sprintf(buf, "filter=%s level=%d strategy=%s, %u trials",
+		filterName(params.filters), params.level < 0 ? 6 : params.level,
+		strategyName(params.strategy), trials);
+	std::string s = buf;
+	if(cutShort)
+	{
+		sprintf(buf, " (%u cut short)", cutShort);
+		s += buf;
+	}
+	if(notRun)
+	{
+		sprintf(buf, ", %u out of time", notRun);
+		s += buf;
+	}
+	return s;
+}
+
+bool optimizePNG(const Image& img, double budgetMs, unsigned threads,
+                 std::vector<unsigned char>& out, OptimizeResult *result)
+{
+	TrialState st;
+	st.img = &img;
+	st.deadline = budgetMs > 0 ? timeMs() + budgetMs : 0;
+	st.next = 0;
+	st.defaultSize = 0;
+	st.started = st.cutShort = st.notRun = 0;
+
+	if(!threads)
+		threads = 1;
+	if(threads > numTrials)
+		threads = numTrials;
+	// The calling thread takes part, too
+	Thread *helpers = new Thread[threads - 1];
+	for(unsigned i = 0; i < threads - 1; ++i)
+		helpers[i].start(trialThread, &st);
+	trialThread(&st);
+	delete [] helpers; // joins
+
+	if(st.best.empty())
+		return false;
+	out.swap(st.best);
+	if(result)
+	{
+		result->params = st.bestParams;
+		result->defaultSize = st.defaultSize;
+		result->trials = st.started;
+		result->cutShort = st.cutShort;
+		result->notRun = st.notRun;
+	}
+	return true;
+}
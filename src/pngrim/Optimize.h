@@ -0,0 +1,32 @@
+
+/* This code is released into the public domain. */
+
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <string>
+#include <vector>
+#include "ImagePNG.h"
+
+struct OptimizeResult
+{
+	OptimizeResult() : defaultSize(0), trials(0), cutShort(0), notRun(0) {}
+
+	PNGWriteParams params; // winning settings
+	size_t defaultSize;    // size with libpng defaults, for comparison
+	unsigned trials;       // trials started
+	unsigned cutShort;     // of those, stopped early (too big / out of time)
+	unsigned notRun;       // trials not started because time was up
+
+	std::string describe() const;
+};
+
+// Encodes img with a range of filter and zlib settings on 'threads'
+// threads and keeps the smallest output. Trials that grow beyond the best
+// result so far are cut short. If budgetMs > 0, no trial runs past that
+// time, except the one with libpng's defaults, which always completes so
+// that there is a result.
+bool optimizePNG(const Image& img, double budgetMs, unsigned threads,
+                 std::vector<unsigned char>& out, OptimizeResult *result = 0);
+
+#endif
@@ -0,0 +1,359 @@
+
+/* This code is released into the public domain. */
+
+#include "PNGWriter.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <png.h>
+#include <zlib.h>
+#include "Thread.h"
+#include "Timer.h"
+
+namespace {
+
+// Filtered bytes per block. Smaller blocks balance better over the threads
+// but each one costs a sync flush and re-filtering the dictionary rows.
+const size_t BLOCK_BYTES = 1 << 20;
+// Deflate can't look back further than this anyway
+const size_t DICT_BYTES = 32768;
+// Filtered bytes handed to deflate at a time
+const size_t BATCH_BYTES = 64 * 1024;
+const unsigned BPP = 4;
+// Compressed bytes per IDAT at most, leaving room for the zlib header and
+// trailer within the PNG chunk length limit
+const size_t IDAT_MAX_DATA = PNG_UINT_31_MAX - 6;
+
+struct Block
+{
+	Block() : y0(0), y1(0), adler(1), crc(0), rawBytes(0) {}
+
+	unsigned y0, y1;
+	std::vector<unsigned char> data; // raw deflate, byte aligned at the end
+	unsigned long adler;             // of the filtered rows, from 1
+	unsigned long crc;               // of data, from 0
+	size_t rawBytes;
+};
+
+struct BlockState
+{
+	const unsigned int *pixels;
+	unsigned width, height;
+	size_t rowBytes; // without the filter byte
+	const PNGWriteParams *params;
+	int level, strategy, filters;
+	std::vector<Block> blocks;
+	unsigned next;
+	bool failed;
+	Mutex mtx;
+};
+
+void toRGBA(unsigned char *dst, const unsigned int *src, unsigned w)
+{
+	for(unsigned x = 0; x < w; ++x)
+	{
+		const unsigned int v = *src++;
+		*dst++ = v & 0xff;         // R
+		*dst++ = (v >> 8) & 0xff;  // G
+		*dst++ = (v >> 16) & 0xff; // B
+		*dst++ = v >> 24;          // A
+	}
+}
+
+// Converts and filters consecutive rows of the image
+class RowFilter
+{
+	const BlockState& m_st;
+	std::vector<unsigned char> m_rowA, m_rowB, m_scratch;
+	unsigned char *m_cur, *m_prev;
+	unsigned m_y;
+
+public:
+	RowFilter(const BlockState& st, unsigned y)
+		: m_st(st), m_rowA(st.rowBytes), m_rowB(st.rowBytes), m_scratch(5 * (st.rowBytes + 1)), m_y(y)
+	{
+		m_cur = &m_rowA[0];
+		m_prev = &m_rowB[0];
+		if(y)
+			toRGBA(m_prev, st.pixels + (size_t)(y - 1) * st.width, st.width);
+	}
+
+	// Writes the next n rows, each with its filter byte, to dst
+	void rows(unsigned char *dst, unsigned n)
+	{
+		const size_t stride = m_st.rowBytes + 1;
+		for(unsigned end = m_y + n; m_y < end; ++m_y, dst += stride)
+		{
+			toRGBA(m_cur, m_st.pixels + (size_t)m_y * m_st.width, m_st.width);
+			// Same filter choice as png_write_row()
+			const png_bytep row = png_filter_row(m_st.filters, BPP, m_st.rowBytes, m_cur, m_y ? m_prev : NULL, &m_scratch[0]);
+			memcpy(dst, row, stride);
+			unsigned char *t = m_prev;
+			m_prev = m_cur;
+			m_cur = t;
+		}
+	}
+};
+
+// Runs deflate until it has taken all input and, unless flush is
+// Z_NO_FLUSH, written all output, growing out as needed.
+bool deflateAll(z_stream& z, int flush, std::vector<unsigned char>& out)
+{
+	for(;;)
+	{
+		if(z.total_out == out.size())
+			out.resize(out.size() * 2);
+		z.next_out = &out[z.total_out];
+		z.avail_out = (uInt)(out.size() - z.total_out);
+		const int ret = deflate(&z, flush);
+		if(ret == Z_STREAM_END)
+			return flush == Z_FINISH;
+		if(ret != Z_OK && ret != Z_BUF_ERROR)
+			return false;
+		if(flush == Z_NO_FLUSH ? !z.avail_in : flush != Z_FINISH && z.avail_out)
+			return true;
+	}
+}
+
+bool compressBlock(const BlockState& st, Block& blk, bool last)
+{
+	const size_t stride = st.rowBytes + 1;
+	// Earlier rows that make up the dictionary
+	unsigned dictRows = (unsigned)((DICT_BYTES + stride - 1) / stride);
+	if(dictRows > blk.y0)
+		dictRows = blk.y0;
+	// Rows are filtered and deflated a batch at a time, so a block can be
+	// the whole image without a filtered copy of all of it
+	unsigned batchRows = (unsigned)(BATCH_BYTES / stride);
+	if(!batchRows)
+		batchRows = 1;
+
+	RowFilter filter(st, blk.y0 - dictRows);
+	std::vector<unsigned char> filtered((size_t)(dictRows > batchRows ? dictRows : batchRows) * stride);
+
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	if(deflateInit2(&z, st.level, Z_DEFLATED, -15, 8, st.strategy) != Z_OK)
+		return false;
+	if(st.params->strides)
+		deflateStrides(&z, BPP, (uInt)stride);
+	if(dictRows)
+	{
+		const size_t dictBytes = (size_t)dictRows * stride;
+		const size_t n = dictBytes < DICT_BYTES ? dictBytes : DICT_BYTES;
+		filter.rows(&filtered[0], dictRows);
+		deflateSetDictionary(&z, &filtered[dictBytes - n], (uInt)n);
+	}
+
+	// Grows with the output; most images compress well below a quarter
+	blk.data.resize((size_t)(blk.y1 - blk.y0) * stride / 4 + 1024);
+	blk.adler = 1;
+	blk.rawBytes = 0;
+	bool ok = true;
+	for(unsigned y = blk.y0; ok && y < blk.y1; )
+	{
+		const unsigned n = blk.y1 - y < batchRows ? blk.y1 - y : batchRows;
+		const size_t bytes = (size_t)n * stride;
+		filter.rows(&filtered[0], n);
+		blk.adler = adler32(blk.adler, &filtered[0], (uInt)bytes);
+		blk.rawBytes += bytes;
+		y += n;
+
+		z.next_in = &filtered[0];
+		z.avail_in = (uInt)bytes;
+		ok = deflateAll(z, y < blk.y1 ? Z_NO_FLUSH : last ? Z_FINISH : Z_SYNC_FLUSH, blk.data);
+	}
+	blk.data.resize(z.total_out);
+	deflateEnd(&z);
+	if(ok)
+		blk.crc = crc32(0L, blk.data.empty() ? NULL : &blk.data[0], (uInt)blk.data.size());
+	return ok;
+}
+
+void blockThread(void *p)
+{
+	BlockState& st = *(BlockState*)p;
+	for(;;)
+	{
+		unsigned i;
+		{
+			MutexLock lock(st.mtx);
+			if(st.failed || st.next == st.blocks.size())
+				return;
+			i = st.next++;
+		}
+		bool ok = !(st.params->deadline && timeMs() > st.params->deadline);
+		if(ok)
+			ok = compressBlock(st, st.blocks[i], i + 1 == st.blocks.size());
+		if(!ok)
+		{
+			MutexLock lock(st.mtx);
+			st.failed = true;
+			return;
+		}
+	}
+}
+
+void putU32(std::vector<unsigned char>& out, unsigned long v)
+{
+	out.push_back((unsigned char)(v >> 24));
+	out.push_back((unsigned char)(v >> 16));
+	out.push_back((unsigned char)(v >> 8));
+	out.push_back((unsigned char)v);
+}
+
+void putChunk(std::vector<unsigned char>& out, const char *type, const unsigned char *data, size_t size)
+{
+	putU32(out, (unsigned long)size);
+	out.insert(out.end(), type, type + 4);
+	unsigned long crc = crc32(0L, (const Bytef*)type, 4);
+	if(size) // crc32() with a NULL buffer restarts instead
+	{
+		out.insert(out.end(), data, data + size);
+		crc = crc32(crc, data, (uInt)size);
+	}
+	putU32(out, crc);
+}
+
+} // end anonymous namespace
+
+bool useBlockWriter(unsigned width, unsigned height, unsigned threads)
+{
+	return threads > 1 && (size_t)width * height * BPP >= 2 * BLOCK_BYTES;
+}
+
+PNGWriteParams fastWriteParams(unsigned threads)
+{
+	// Sub is the cheapest filter that still helps deflate a lot; Up packs
+	// worse, Z_RLE isn't faster and decodes slower, stored is 10x the size.
+	PNGWriteParams p;
+	p.filters = PNG_FILTER_SUB;
+	p.level = 1;
+	p.strides = true;
+	p.threads = threads;
+	p.direct = true;
+	return p;
+}
+
+bool writePNGBlocks(const unsigned int *pixels, unsigned width, unsigned height,
+                    const PNGWriteParams& params, std::vector<unsigned char>& out)
+{
+	BlockState st;
+	st.pixels = pixels;
+	st.width = width;
+	st.height = height;
+	st.rowBytes = (size_t)width * BPP;
+	st.params = &params;
+	// Same defaults and mask handling as libpng
+	st.filters = params.filters < 0 ? PNG_ALL_FILTERS : params.filters;
+	if(st.filters <= PNG_FILTER_VALUE_PAETH)
+		st.filters = PNG_FILTER_NONE << st.filters;
+	st.filters &= PNG_ALL_FILTERS;
+	if(!st.filters)
+		st.filters = PNG_FILTER_NONE;
+	st.level = params.level < 0 ? Z_DEFAULT_COMPRESSION : params.level;
+	st.strategy = params.strategy >= 0 ? params.strategy :
+		st.filters != PNG_FILTER_NONE ? Z_FILTERED : Z_DEFAULT_STRATEGY;
+	st.next = 0;
+	st.failed = false;
+
+	// One thread gains nothing from blocks but their overhead
+	size_t rowsPerBlock = params.threads > 1 ? BLOCK_BYTES / (st.rowBytes + 1) : height;
+	if(!rowsPerBlock)
+		rowsPerBlock = 1;
+	for(unsigned y = 0; y < height; y += (unsigned)rowsPerBlock)
+	{
+		Block b;
+		b.y0 = y;
+		b.y1 = height - y > rowsPerBlock ? y + (unsigned)rowsPerBlock : height;
+		st.blocks.push_back(b);
+	}
+	if(st.blocks.empty())
+		return false;
+
+	unsigned threads = params.threads;
+	if(threads > st.blocks.size())
+		threads = (unsigned)st.blocks.size();
+	if(!threads)
+		threads = 1;
+	// The calling thread takes part, too
+	Thread *helpers = new Thread[threads - 1];
+	for(unsigned i = 0; i < threads - 1; ++i)
+		helpers[i].start(blockThread, &st);
+	blockThread(&st);
+	delete [] helpers; // joins
+
+	if(st.failed)
+	{
+		if(!params.deadline)
+			printf("[write_png_file] Error during block compression\n");
+		return false;
+	}
+
+	out.clear();
+	static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+	out.insert(out.end(), signature, signature + 8);
+
+	unsigned char ihdr[13];
+	png_save_uint_32(ihdr, width);
+	png_save_uint_32(ihdr + 4, height);
+	ihdr[8] = 8;                     // bit depth
+	ihdr[9] = PNG_COLOR_TYPE_RGBA;
+	ihdr[10] = PNG_COMPRESSION_TYPE_BASE;
+	ihdr[11] = PNG_FILTER_TYPE_BASE;
+	ihdr[12] = PNG_INTERLACE_NONE;
+	putChunk(out, "IHDR", ihdr, sizeof(ihdr));
+
+	// zlib header for a 32K window, with the level hint deflate would write
+	const int level = st.level == Z_DEFAULT_COMPRESSION ? 6 : st.level;
+	const unsigned levelFlags = st.strategy >= Z_HUFFMAN_ONLY || level < 2 ? 0 :
+		level < 6 ? 1 : level == 6 ? 2 : 3;
+	unsigned header = (0x78 << 8) | (levelFlags << 6);
+	header += 31 - header % 31;
+	const unsigned char zhdr[2] = { (unsigned char)(header >> 8), (unsigned char)header };
+
+	// One IDAT per block (more if it doesn't fit in one), the first one
+	// also carries the zlib header and the last one the Adler-32 of all
+	// filtered data
+	unsigned long adler = 1;
+	for(size_t i = 0; i < st.blocks.size(); ++i)
+	{
+		const Block& b = st.blocks[i];
+		adler = adler32_combine(adler, b.adler, (z_off_t)b.rawBytes);
+		unsigned char trailer[4];
+		png_save_uint_32(trailer, adler);
+
+		size_t pos = 0;
+		do
+		{
+			const size_t n = b.data.size() - pos < IDAT_MAX_DATA ? b.data.size() - pos : IDAT_MAX_DATA;
+			const bool first = i == 0 && pos == 0;
+			const bool last = i + 1 == st.blocks.size() && pos + n == b.data.size();
+			putU32(out, (unsigned long)(n + (first ? 2 : 0) + (last ? 4 : 0)));
+			out.insert(out.end(), "IDAT", "IDAT" + 4);
+			unsigned long crc = crc32(0L, (const Bytef*)"IDAT", 4);
+			if(first)
+			{
+				out.insert(out.end(), zhdr, zhdr + 2);
+				crc = crc32(crc, zhdr, 2);
+			}
+			out.insert(out.end(), b.data.begin() + pos, b.data.begin() + pos + n);
+			if(n == b.data.size())
+				crc = crc32_combine(crc, b.crc, (z_off_t)n);
+			else
+				crc = crc32(crc, &b.data[pos], (uInt)n);
+			if(last)
+			{
+				out.insert(out.end(), trailer, trailer + 4);
+				crc = crc32(crc, trailer, 4);
+			}
+			putU32(out, crc);
+			pos += n;
+		} while(pos < b.data.size());
+	}
+	putChunk(out, "IEND", NULL, 0);
+
+	if(params.sizeLimit && out.size() > params.sizeLimit)
+		return false;
+	return true;
+}
@@ -0,0 +1,30 @@
+
+/* This code is released into the public domain. */
+
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <vector>
+#include "ImagePNG.h"
+
+// Encodes an 8 bit RGBA image (pixels as in Image, 0xAABBGGRR) without
+// libpng's row loop, pigz style: the rows are cut into blocks that are
+// filtered and deflated on params.threads threads (the caller's included).
+// Each block is primed with the last 32 KB of the previous block's filtered
+// data as preset dictionary and ends on a byte boundary (Z_SYNC_FLUSH), so
+// the blocks concatenate into one zlib stream; the Adler-32 and IDAT CRCs
+// are combined from the per-block values. Rows get the same filters as
+// with libpng's heuristic, the size stays within a fraction of a percent of
+// a serial encode. Honors all fields of params.
+bool writePNGBlocks(const unsigned int *pixels, unsigned width, unsigned height,
+                    const PNGWriteParams& params, std::vector<unsigned char>& out);
+
+// True if writePNGBlocks() pays off for an image of this size.
+bool useBlockWriter(unsigned width, unsigned height, unsigned threads);
+
+// Speed over size (--fast-write): Sub filter on every row, zlib level 1
+// with the stride probes, straight through writePNGBlocks(). About 4x
+// faster than the defaults for files a few percent larger.
+PNGWriteParams fastWriteParams(unsigned threads);
+
+#endif
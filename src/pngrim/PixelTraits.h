@@ -0,0 +1,59 @@
+
+/* This code is released into the public domain. */
+
+#ifndef PIXELTRAITS_H
+#define PIXELTRAITS_H
+
+#include "ImagePNG.h"
+
+// Compile-time description of an Image pixel format, for code that is
+// instantiated once per format instead of branching per pixel.
+// Pixel packs the channels, BITS each, first channel in the lowest bits
+// and alpha in the highest. Sum accumulates one channel over the up to 8
+// neighbours of a pixel without overflowing.
+template<typename P, unsigned CHANNELS, unsigned BITS, typename S, PixelFormat FORMAT>
+struct PixelTraits
+{
+	typedef P Pixel;
+	typedef S Sum;
+
+	enum
+	{
+		channels = CHANNELS,
+		colors = CHANNELS - 1, // channels without alpha
+		bits = BITS,
+		bytes = BITS / 8,      // per channel in a PNG row
+		max = (1u << BITS) - 1
+	};
+	static const PixelFormat format = FORMAT;
+
+	static inline unsigned channel(Pixel p, unsigned i) { return unsigned(p >> (BITS * i)) & max; }
+	static inline unsigned alpha(Pixel p) { return unsigned(p >> (BITS * colors)); }
+	static inline Pixel place(unsigned v, unsigned i) { return Pixel(v) << (BITS * i); }
+
+	// One pixel from a PNG row (big endian channels)
+	static inline Pixel load(const unsigned char *b)
+	{
+		Pixel p = 0;
+		for(unsigned i = 0; i < CHANNELS; ++i, b += bytes)
+			p |= place(bytes == 2 ? (b[0] << 8) | b[1] : b[0], i);
+		return p;
+	}
+	static inline void store(Pixel p, unsigned char *b)
+	{
+		for(unsigned i = 0; i < CHANNELS; ++i)
+		{
+			const unsigned v = channel(p, i);
+			if(bytes == 2)
+				*b++ = (unsigned char)(v >> 8);
+			*b++ = (unsigned char)v;
+		}
+	}
+};
+
+typedef PixelTraits<unsigned int,       4, 8,  unsigned, PIXEL_RGBA8>  RGBA8Traits;
+typedef PixelTraits<unsigned short,     2, 8,  unsigned, PIXEL_GA8>    GA8Traits;
+typedef PixelTraits<unsigned long long, 4, 16, unsigned, PIXEL_RGBA16> RGBA16Traits;
+typedef PixelTraits<unsigned int,       2, 16, unsigned, PIXEL_GA16>   GA16Traits;
+
+#endif
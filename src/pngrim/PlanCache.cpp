@@ -0,0 +1,240 @@
+
+/* This code is released into the public domain. */
+
+#include "PlanCache.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "FileLoader.h"
+#include "pngrim.h"
+
+#ifdef _WIN32
+#  include <process.h>
+#  define getpid _getpid
+#else
+#  include <unistd.h>
+#endif
+
+namespace {
+
+// File layout: magic, then width, height, numtrans and the number of steps
+// (32 bit little endian), the pixels (32 bit each), the neighbour masks.
+const char PLAN_MAGIC[8] = { 'p', 'n', 'g', 'r', 'i', 'm', 'P', '1' };
+const size_t PLAN_HEADER = sizeof(PLAN_MAGIC) + 16;
+
+void putU32(std::vector<unsigned char>& out, unsigned v)
+{
+	for(unsigned i = 0; i < 4; ++i)
+		out.push_back((unsigned char)(v >> (8 * i)));
+}
+
+unsigned getU32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+// A plan from disk is checked enough that applying it can't go outside the
+// image: distinct pixels, every step averaging at least one neighbour, and
+// no neighbour past the border. planMatches() does the rest.
+bool validPlan(const FillPlan& plan)
+{
+	const unsigned w = plan.width, h = plan.height;
+	const size_t n = plan.pixels.size();
+	if(n ? n != plan.numtrans : plan.numtrans && plan.numtrans != (size_t)w * h)
+		return false;
+	std::vector<bool> seen((size_t)w * h);
+	for(size_t i = 0; i < n; ++i)
+	{
+		const unsigned p = plan.pixels[i];
+		if(p >= (size_t)w * h || seen[p] || !plan.neighbours[i])
+			return false;
+		seen[p] = true;
+		const unsigned x = p % w, y = p / w;
+		for(unsigned k = 0; k < 8; ++k)
+			if((plan.neighbours[i] & (1 << k)) &&
+			   (unsigned(x + NEIGHBOURS[k][0]) >= w || unsigned(y + NEIGHBOURS[k][1]) >= h))
+				return false;
+	}
+	return true;
+}
+
+} // end anonymous namespace
+
+PlanCache::PlanCache(size_t maxBytes, const char *dir)
+	: m_bytes(0), m_maxBytes(maxBytes), m_dir(dir ? dir : ""), m_saves(0)
+{
+}
+
+PlanCache::~PlanCache()
+{
+	for(std::list<Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+		delete it->plan;
+	for(std::list<Entry>::iterator it = m_retired.begin(); it != m_retired.end(); ++it)
+		delete it->plan;
+}
+
+const FillPlan *PlanCache::acquire(const FastAnalysis& pre, bool accurate)
+{
+	const unsigned w = (unsigned)pre.dist.width(), h = (unsigned)pre.dist.height();
+	const FillPlan *found = 0;
+	{
+		MutexLock lock(m_mtx);
+		for(std::list<Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+		{
+			const FillPlan& p = *it->plan;
+			if(it->hash == pre.maskHash && p.width == w && p.height == h && p.numtrans == pre.numtrans &&
+			   p.accurate == accurate)
+			{
+				++it->refs;
+				found = it->plan;
+				m_entries.splice(m_entries.begin(), m_entries, it);
+				break;
+			}
+		}
+	}
+	// Checked without the lock, it reads every transparent pixel
+	if(found)
+	{
+		if(planMatches(*found, pre))
+			return found;
+		release(found); // hash collision
+		return 0;
+	}
+
+	if(m_dir.empty())
+		return 0;
+	FillPlan *loaded = _load(pre.maskHash, w, h, accurate);
+	if(!loaded)
+		return 0;
+	if(!planMatches(*loaded, pre))
+	{
+		delete loaded;
+		return 0;
+	}
+	return _add(pre.maskHash, loaded);
+}
+
+const FillPlan *PlanCache::insert(unsigned long long hash, FillPlan *plan)
+{
+	if(!m_dir.empty())
+		_save(hash, *plan);
+	return _add(hash, plan);
+}
+
+void PlanCache::release(const FillPlan *plan)
+{
+	MutexLock lock(m_mtx);
+	for(std::list<Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+		if(it->plan == plan)
+		{
+			--it->refs;
+			return;
+		}
+	for(std::list<Entry>::iterator it = m_retired.begin(); it != m_retired.end(); ++it)
+		if(it->plan == plan)
+		{
+			if(!--it->refs)
+			{
+				delete it->plan;
+				m_retired.erase(it);
+			}
+			return;
+		}
+}
+
+const FillPlan *PlanCache::_add(unsigned long long hash, FillPlan *plan)
+{
+	Entry e;
+	e.hash = hash;
+	e.plan = plan;
+	e.refs = 1;
+
+	MutexLock lock(m_mtx);
+	if(plan->bytes() > m_maxBytes)
+	{
+		m_retired.push_back(e);
+		return plan;
+	}
+	m_entries.push_front(e);
+	m_bytes += plan->bytes();
+	while(m_bytes > m_maxBytes)
+	{
+		Entry& last = m_entries.back();
+		m_bytes -= last.plan->bytes();
+		if(last.refs)
+			m_retired.push_back(last);
+		else
+			delete last.plan;
+		m_entries.pop_back();
+	}
+	return plan;
+}
+
+std::string PlanCache::_fileName(unsigned long long hash, unsigned w, unsigned h, bool accurate) const
+{
+	char name[64];
+	sprintf(name, "/%08x%08x-%ux%u%s.plan", unsigned(hash >> 32), unsigned(hash), w, h, accurate ? "-accurate" : "-fast");
+	return m_dir + name;
+}
+
+FillPlan *PlanCache::_load(unsigned long long hash, unsigned w, unsigned h, bool accurate) const
+{
+	const std::string fn = _fileName(hash, w, h, accurate);
+	std::vector<unsigned char> data;
+	if(!FileLoader::readFile(fn.c_str(), data) || data.size() < PLAN_HEADER ||
+	   memcmp(&data[0], PLAN_MAGIC, sizeof(PLAN_MAGIC)))
+		return 0;
+
+	const unsigned char *p = &data[sizeof(PLAN_MAGIC)];
+	const size_t n = getU32(p + 12);
+	if(getU32(p) != w || getU32(p + 4) != h || n > (size_t)w * h || data.size() != PLAN_HEADER + 5 * n)
+		return 0;
+
+	FillPlan *plan = new FillPlan;
+	plan->width = w;
+	plan->height = h;
+	plan->numtrans = getU32(p + 8);
+	plan->accurate = accurate;
+	plan->pixels.resize(n);
+	plan->neighbours.resize(n);
+	p += 16;
+	for(size_t i = 0; i < n; ++i, p += 4)
+		plan->pixels[i] = getU32(p);
+	if(n)
+		memcpy(&plan->neighbours[0], p, n);
+	if(!validPlan(*plan))
+	{
+		printf("Ignoring broken fill plan %s\n", fn.c_str());
+		delete plan;
+		return 0;
+	}
+	return plan;
+}
+
+void PlanCache::_save(unsigned long long hash, const FillPlan& plan)
+{
+	const size_t n = plan.pixels.size();
+	std::vector<unsigned char> data(PLAN_MAGIC, PLAN_MAGIC + sizeof(PLAN_MAGIC));
+	data.reserve(PLAN_HEADER + 5 * n);
+	putU32(data, plan.width);
+	putU32(data, plan.height);
+	putU32(data, (unsigned)plan.numtrans);
+	putU32(data, (unsigned)n);
+	for(size_t i = 0; i < n; ++i)
+		putU32(data, plan.pixels[i]);
+	data.insert(data.end(), plan.neighbours.begin(), plan.neighbours.end());
+
+	// Other threads and processes only ever see complete files
+	const std::string fn = _fileName(hash, plan.width, plan.height, plan.accurate);
+	// A temporary name of its own for every save of every process
+	unsigned save;
+	{
+		MutexLock lock(m_mtx);
+		save = m_saves++;
+	}
+	char suffix[32];
+	sprintf(suffix, ".%d-%u.tmp", (int)getpid(), save);
+	const std::string tmp = fn + suffix;
+	if(!FileLoader::writeFile(tmp.c_str(), data) || rename(tmp.c_str(), fn.c_str()))
+		remove(tmp.c_str());
+}
@@ -0,0 +1,57 @@
+
+/* This code is released into the public domain. */
+
+#ifndef PLANCACHE_H
+#define PLANCACHE_H
+
+#include <stddef.h>
+#include <list>
+#include <string>
+#include "Thread.h"
+
+struct FillPlan;
+class FastAnalysis;
+
+// FillPlans of pngrimFast() and pngrimAccurate(), looked up by the hash of the transparent
+// pixels (FastAnalysis::maskHash) and checked against the actual pixels
+// before use. Batches of recolored sprites then only pay for filling in
+// the colors. Up to maxBytes of plans are kept in memory, the least
+// recently used go first. With a directory, plans are also written there
+// (one file each) and read back on a miss, so they outlive the process.
+// Thread safe.
+class PlanCache
+{
+public:
+	PlanCache(size_t maxBytes, const char *dir = 0);
+	~PlanCache();
+
+	// A plan of the given engine for exactly the transparent pixels pre
+	// has seen, or NULL.
+	// A plan returned by acquire() or insert() must be release()d.
+	const FillPlan *acquire(const FastAnalysis& pre, bool accurate);
+	// Takes ownership of a new plan, returns it acquired.
+	const FillPlan *insert(unsigned long long hash, FillPlan *plan);
+	void release(const FillPlan *plan);
+
+private:
+	struct Entry
+	{
+		unsigned long long hash;
+		FillPlan *plan;
+		unsigned refs;
+	};
+
+	const FillPlan *_add(unsigned long long hash, FillPlan *plan);
+	std::string _fileName(unsigned long long hash, unsigned w, unsigned h, bool accurate) const;
+	FillPlan *_load(unsigned long long hash, unsigned w, unsigned h, bool accurate) const;
+	void _save(unsigned long long hash, const FillPlan& plan);
+
+	std::list<Entry> m_entries; // most recently used first
+	std::list<Entry> m_retired; // evicted or too big, still in use
+	size_t m_bytes, m_maxBytes;
+	std::string m_dir;
+	unsigned m_saves; // for unique temporary file names
+	Mutex m_mtx;
+};
+
+#endif
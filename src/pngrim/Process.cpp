@@ -0,0 +1,330 @@
+
+/* This code is released into the public domain. */
+
+#include "Process.h"
+#include <stdio.h>
+#include <algorithm>
+#include "ImagePNG.h"
+#include "Optimize.h"
+#include "PNGWriter.h"
+#include "ThreadPool.h"
+#include "Thread.h"
+#include "Timer.h"
+#include "pngrim.h"
+
+namespace {
+
+// Images with at least this many pixels get a separate analysis thread
+// while decoding; for smaller ones the handoff costs more than it saves.
+const unsigned PIPELINE_MIN_PIXELS = 1024 * 1024;
+// Rows are passed to the analysis thread in batches of this many.
+const unsigned PIPELINE_BATCH_ROWS = 16;
+
+// Runs FastAnalysis on decoded rows while the rest of the image is still
+// being inflated: inline for small images, on its own thread for big ones.
+class AnalysisPipe : public RowListener
+{
+public:
+	AnalysisPipe(FastAnalysis& fa) : m_fa(fa), m_img(0), m_ready(0), m_done(0), m_threaded(false) {}
+	~AnalysisPipe() { finish(); }
+
+	virtual void begin(const Image& img)
+	{
+		m_img = &img;
+		m_fa.begin(img.width(), img.height());
+		if(img.numPixels() >= PIPELINE_MIN_PIXELS)
+		{
+			// Set before the thread starts reading it, cleared if it didn't
+			MutexLock lock(m_mtx);
+			m_threaded = true;
+			if(!m_thread.start(_thread, this))
+				m_threaded = false;
+		}
+	}
+
+	virtual void rows(const Image& img, unsigned y0, unsigned y1)
+	{
+		if(!m_threaded)
+		{
+			for(unsigned y = y0; y < y1; ++y)
+				m_fa.row(img, y);
+			m_done = y1;
+			return;
+		}
+		if(y1 == img.height() || y1 - m_ready >= PIPELINE_BATCH_ROWS)
+		{
+			MutexLock lock(m_mtx);
+			m_ready = y1;
+			m_cv.signal();
+		}
+	}
+
+	// Wait for the analysis thread; returns true if all rows were analyzed.
+	bool finish()
+	{
+		if(m_threaded)
+		{
+			{
+				MutexLock lock(m_mtx);
+				m_threaded = false; // also wakes up the thread if decoding failed
+				m_cv.signal();
+			}
+			m_thread.join();
+		}
+		return m_img && m_done == m_img->height();
+	}
+
+private:
+	static void _thread(void *self) { ((AnalysisPipe*)self)->_run(); }
+
+	void _run()
+	{
+		const unsigned h = m_img->height();
+		MutexLock lock(m_mtx);
+		while(m_done < h)
+		{
+			while(m_threaded && m_ready == m_done)
+				m_cv.wait(m_mtx);
+			const unsigned ready = m_ready;
+			if(ready == m_done)
+				break;
+			m_mtx.unlock();
+			for(unsigned y = m_done; y < ready; ++y)
+				m_fa.row(*m_img, y);
+			m_mtx.lock();
+			m_done = ready;
+		}
+	}
+
+	FastAnalysis& m_fa;
+	const Image *m_img;
+	unsigned m_ready, m_done;
+	bool m_threaded;
+	Mutex m_mtx;
+	CondVar m_cv;
+	Thread m_thread;
+};
+
+// pngrimAccurate(), with the plan cache only if opt keeps accurate plans
+void fillAccurate(Image& img, const ProcessOptions& opt)
+{
+	pngrimAccurate(img, opt.accuratePlans ? opt.planCache : NULL);
+}
+
+// Shared by the threads and pool jobs working on one grid. Pool jobs may
+// run after processGrid() returned, so it is freed by the last user.
+struct GridState
+{
+	Image *img;
+	const ProcessOptions *opt;
+	unsigned columns, cells, next, done;
+	unsigned refs;
+	Mutex mtx;
+	CondVar cv;
+};
+
+void releaseGrid(GridState *st)
+{
+	bool last;
+	{
+		MutexLock lock(st->mtx);
+		last = !--st->refs;
+	}
+	if(last)
+		delete st;
+}
+
+// Fills cells until none are left. Only touches img and opt while it
+// has a cell that processGrid() is waiting for.
+void gridThread(void *p)
+{
+	GridState& st = *(GridState*)p;
+	Image cell;
+	for(;;)
+	{
+		unsigned i;
+		{
+			MutexLock lock(st.mtx);
+			if(st.next == st.cells)
+				return;
+			i = st.next++;
+		}
+		const ProcessOptions& opt = *st.opt;
+		const unsigned w = st.img->width(), h = st.img->height();
+		const unsigned x = i % st.columns * opt.gridWidth;
+		const unsigned y = i / st.columns * opt.gridHeight;
+		st.img->crop(cell, x, y, std::min(opt.gridWidth, w - x), std::min(opt.gridHeight, h - y));
+		// Sprites with the same outline share a plan
+		if(opt.smooth)
+			pngrimSmooth(cell);
+		else if(opt.fast)
+			pngrimFast(cell, NULL, opt.planCache);
+		else
+			fillAccurate(cell, opt);
+		st.img->paste(cell, x, y);
+
+		MutexLock lock(st.mtx);
+		if(++st.done == st.cells)
+			st.cv.signal();
+	}
+}
+
+class GridJob : public Job
+{
+	GridState *m_st;
+public:
+	GridJob(GridState *st) : m_st(st) {}
+	virtual void run()
+	{
+		gridThread(m_st);
+		releaseGrid(m_st);
+	}
+};
+
+// Every cell of opt's grid as an image of its own. Besides trialThreads,
+// idle workers of opt.pool join in.
+void processGrid(Image& img, const ProcessOptions& opt)
+{
+	GridState *st = new GridState;
+	st->img = &img;
+	st->opt = &opt;
+	st->columns = (img.width() + opt.gridWidth - 1) / opt.gridWidth;
+	st->cells = st->columns * ((img.height() + opt.gridHeight - 1) / opt.gridHeight);
+	st->next = 0;
+	st->done = 0;
+	st->refs = 1;
+
+	unsigned threads = opt.trialThreads ? opt.trialThreads : 1;
+	if(threads > st->cells)
+		threads = st->cells;
+	// The calling thread (a pool worker itself) takes part, too
+	unsigned jobs = opt.pool ? opt.pool->size() - 1 : 0;
+	if(jobs > st->cells - threads)
+		jobs = st->cells - threads;
+	st->refs += jobs;
+	for(unsigned i = 0; i < jobs; ++i)
+		opt.pool->add(new GridJob(st), opt.priority);
+	Thread *helpers = threads > 1 ? new Thread[threads - 1] : NULL;
+	for(unsigned i = 0; i + 1 < threads; ++i)
+		helpers[i].start(gridThread, st);
+	gridThread(st);
+	delete [] helpers; // joins
+	{
+		// Cells still being filled by pool jobs
+		MutexLock lock(st->mtx);
+		while(st->done < st->cells)
+			st->cv.wait(st->mtx);
+	}
+	releaseGrid(st);
+}
+
+// pre as for pngrimFast()
+void processImage(Image& img, const ProcessOptions& opt, FastAnalysis *pre)
+{
+	if(opt.gridWidth && opt.gridHeight)
+	{
+		processGrid(img, opt);
+		return;
+	}
+	if(opt.smooth)
+	{
+		pngrimSmooth(img);
+		return;
+	}
+	if(opt.since && opt.planCache)
+	{
+		Image prev;
+		PNGReadParams rp;
+		rp.skipCRC = opt.trustInput;
+		if(prev.readPNG(opt.since, opt.sinceSize, "<previous output>", NULL, rp))
+		{
+			if(!pngrimUpdate(img, prev, !opt.fast, pre, *opt.planCache))
+				printf("No fill plan matches the previous output, filled the whole image\n");
+			return;
+		}
+	}
+	if(opt.fast)
+		pngrimFast(img, pre, opt.planCache);
+	else
+		fillAccurate(img, opt);
+}
+
+} // end anonymous namespace
+
+bool parseGrid(const char *spec, ProcessOptions& opt)
+{
+	unsigned w, h;
+	char end;
+	if(sscanf(spec, "%ux%u%c", &w, &h, &end) != 2 || !w || !h)
+		return false;
+	opt.gridWidth = w;
+	opt.gridHeight = h;
+	return true;
+}
+
+void processImage(Image& img, const ProcessOptions& opt)
+{
+	processImage(img, opt, NULL);
+}
+
+bool processBuffer(const unsigned char *data, size_t size, const char *name,
+                   const ProcessOptions& opt, std::vector<unsigned char>& out,
+                   ProcessStats *stats)
+{
+	Image img;
+	PNGReadParams rp;
+	rp.skipCRC = opt.trustInput;
+	rp.threads = opt.trialThreads;
+	double t0 = timeMs();
+	double t1, t2;
+	if(opt.fast && !opt.smooth && !(opt.gridWidth && opt.gridHeight))
+	{
+		// Overlap the first phase of pngrimFast() with decoding
+		FastAnalysis fa;
+		AnalysisPipe pipe(fa);
+		const bool ok = img.readPNG(data, size, name, &pipe, rp);
+		const bool analyzed = pipe.finish();
+		if(!ok)
+			return false;
+		t1 = timeMs();
+		processImage(img, opt, analyzed ? &fa : NULL);
+		t2 = timeMs();
+	}
+	else
+	{
+		if(!img.readPNG(data, size, name, NULL, rp))
+			return false;
+		t1 = timeMs();
+		processImage(img, opt);
+		t2 = timeMs();
+	}
+	bool ok;
+	if(opt.optimize && !opt.fastWrite)
+	{
+		OptimizeResult res;
+		ok = optimizePNG(img, opt.optimizeMs, opt.trialThreads, out, &res);
+		if(ok && stats)
+		{
+			char buf[64];
+			sprintf(buf, ", %lu bytes (default %lu)", (unsigned long)out.size(), (unsigned long)res.defaultSize);
+			stats->encoder = res.describe() + buf;
+		}
+	}
+	else
+	{
+		PNGWriteParams params;
+		params.threads = opt.trialThreads;
+		if(opt.fastWrite)
+			params = fastWriteParams(opt.trialThreads);
+		ok = img.writePNG(out, params);
+	}
+	double t3 = timeMs();
+
+	if(stats)
+	{
+		stats->readMs = t1 - t0;
+		stats->processMs = t2 - t1;
+		stats->writeMs = t3 - t2;
+	}
+	return ok;
+}
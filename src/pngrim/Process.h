@@ -0,0 +1,66 @@
+
+/* This code is released into the public domain. */
+
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class Image;
+class PlanCache;
+class ThreadPool;
+
+struct ProcessOptions
+{
+	ProcessOptions() : fast(false), smooth(false), optimize(false), fastWrite(false), trustInput(false), optimizeMs(0), trialThreads(1),
+	                   planCache(0), accuratePlans(false), since(0), sinceSize(0), gridWidth(0), gridHeight(0),
+	                   pool(0), priority(0) {}
+
+	bool fast; // use pngrimFast() instead of pngrimAccurate()
+	bool smooth; // use pngrimSmooth(); overrides fast, since is ignored
+	bool optimize; // try several encoder settings, keep the smallest file
+	bool fastWrite; // encode for speed, not size (fastWriteParams()); overrides optimize
+	bool trustInput; // input is known good, skip CRC checks while decoding
+	double optimizeMs; // time budget for optimize, 0 = unlimited
+	unsigned trialThreads; // threads per image for optimize and block encoding
+	PlanCache *planCache; // fill plans shared between images; may be NULL
+	// pngrimAccurate() uses planCache as well. Its plans cost an extra
+	// analysis per image, so only worth it when they are read back.
+	bool accuratePlans;
+	// Earlier output for this input (PNG file), made with the same 'fast'.
+	// Only the fill that depends on changed pixels is redone (pngrimUpdate()).
+	const unsigned char *since;
+	size_t sinceSize;
+	// Cell size of a sprite sheet, 0 = no grid. Each cell is filled on its
+	// own, nothing bleeds across cell borders; cells run on trialThreads
+	// and on idle workers of pool. Takes precedence over since.
+	unsigned gridWidth, gridHeight;
+	// The pool running this image, if any, and the priority of its job;
+	// cells are added to it at that priority.
+	ThreadPool *pool;
+	int priority;
+};
+
+struct ProcessStats
+{
+	ProcessStats() : readMs(0), processMs(0), writeMs(0) {}
+
+	double readMs, processMs, writeMs;
+	std::string encoder; // chosen encoder settings, if optimizing
+};
+
+// Sets opt's grid from "WxH"; false (opt untouched) if malformed.
+bool parseGrid(const char *spec, ProcessOptions& opt);
+
+void processImage(Image& img, const ProcessOptions& opt);
+
+// Decode a complete PNG file from memory, fix it, encode into 'out'.
+// Returns false if the file could not be decoded or encoded;
+// a message was printed in that case.
+bool processBuffer(const unsigned char *data, size_t size, const char *name,
+                   const ProcessOptions& opt, std::vector<unsigned char>& out,
+                   ProcessStats *stats = NULL);
+
+#endif
@@ -0,0 +1,424 @@
+
+/* This code is released into the public domain. */
+
+#include <stdio.h>
+#include "Server.h"
+
+#ifdef _WIN32
+
+int runServer(const char *socketPath, ThreadPool&, PlanCache*)
+{
+	printf("Server mode (%s) is not supported on this platform\n", socketPath);
+	return 1;
+}
+
+#else
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <vector>
+#include <list>
+#include "FileLoader.h"
+#include "Process.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+
+namespace {
+
+// Payloads above this are refused instead of allocated.
+const size_t MAX_PAYLOAD = size_t(1) << 30;
+
+struct Request
+{
+	Request() : isFile(false), prio(0), ok(false), done(false) {}
+
+	bool isFile;
+	int prio;
+	ProcessOptions opt;
+	std::string path, sincePath;
+	std::vector<unsigned char> in, out, since;
+
+	ProcessStats stats;
+	std::string error;
+	bool ok;
+	bool done;
+	Mutex mtx;
+	CondVar cv;
+};
+
+class RequestJob : public Job
+{
+	Request& m_req;
+public:
+	RequestJob(Request& r) : m_req(r) {}
+	virtual void run()
+	{
+		Request& r = m_req;
+		double ioRead = 0, ioWrite = 0;
+		const char *name = r.isFile ? r.path.c_str() : "<data>";
+		if(r.isFile)
+		{
+			double t = timeMs();
+			if(!FileLoader::readFile(name, r.in))
+				r.error = "can't read file";
+			ioRead = timeMs() - t;
+		}
+		if(r.error.empty() && !r.sincePath.empty())
+		{
+			double t = timeMs();
+			if(!FileLoader::readFile(r.sincePath.c_str(), r.since))
+				r.error = "can't read previous output";
+			else if(!r.since.empty())
+			{
+				r.opt.since = &r.since[0];
+				r.opt.sinceSize = r.since.size();
+			}
+			ioRead += timeMs() - t;
+		}
+		if(r.error.empty())
+		{
+			if(!processBuffer(r.in.empty() ? NULL : &r.in[0], r.in.size(), name, r.opt, r.out, &r.stats))
+				r.error = "not processed";
+			else if(r.isFile)
+			{
+				double t = timeMs();
+				if(!FileLoader::writeFile(name, r.out))
+					r.error = "can't write file";
+				ioWrite = timeMs() - t;
+			}
+		}
+		r.stats.readMs += ioRead;
+		r.stats.writeMs += ioWrite;
+
+		MutexLock lock(r.mtx);
+		r.ok = r.error.empty();
+		r.done = true;
+		r.cv.signal();
+	}
+};
+
+class Connection;
+
+// Deletes (joins) connections as soon as they end, so an idle server
+// doesn't keep their threads around
+class Reaper
+{
+public:
+	Reaper() : m_live(0), m_quit(false)
+	{
+		m_thread.start(_thread, this);
+	}
+	// Waits for all connections to end
+	~Reaper()
+	{
+		{
+			MutexLock lock(m_mtx);
+			m_quit = true;
+			m_cv.signal();
+		}
+		m_thread.join();
+	}
+	// Starts the connection's thread, deletes it if that fails
+	void add(Connection *c);
+	void finished(Connection *c)
+	{
+		MutexLock lock(m_mtx);
+		m_done.push_back(c);
+		m_cv.signal();
+	}
+
+private:
+	static void _thread(void *self) { ((Reaper*)self)->_run(); }
+	void _run();
+
+	std::list<Connection*> m_done;
+	size_t m_live; // started, not yet deleted
+	bool m_quit;
+	Mutex m_mtx;
+	CondVar m_cv;
+	Thread m_thread;
+};
+
+class Connection
+{
+public:
+	Connection(int fd, ThreadPool& pool, PlanCache *planCache, Reaper& reaper)
+		: m_fd(fd), m_pool(pool), m_planCache(planCache), m_reaper(reaper), m_bufPos(0), m_bufLen(0)
+	{
+	}
+	~Connection()
+	{
+		m_thread.join();
+		close(m_fd);
+	}
+	bool start()
+	{
+		return m_thread.start(_thread, this);
+	}
+
+private:
+	static void _thread(void *self) { ((Connection*)self)->_run(); }
+
+	void _run()
+	{
+		std::string line;
+		while(_readLine(line) && _handle(line))
+			;
+		m_reaper.finished(this);
+	}
+
+	// After a bad header the payload of a data request (if any) can't be
+	// told apart from the next request, so the connection ends.
+	bool _reject(const Request& r, const char *msg)
+	{
+		return _send(msg) && r.isFile;
+	}
+
+	bool _handle(const std::string& line)
+	{
+		Request r;
+		r.opt.planCache = m_planCache;
+		r.opt.accuratePlans = true; // later requests read them back
+		size_t pos = line.find(' ');
+		const std::string cmd = line.substr(0, pos);
+		if(cmd == "file")
+			r.isFile = true;
+		else if(cmd != "data")
+			return _reject(r, "error unknown command\n");
+
+		std::string arg;
+		while(pos != std::string::npos)
+		{
+			size_t end = line.find(' ', pos + 1);
+			const std::string tok = line.substr(pos + 1, end == std::string::npos ? end : end - pos - 1);
+			if(tok == "fast")
+				r.opt.fast = true;
+			else if(tok == "smooth")
+				r.opt.smooth = true;
+			else if(tok == "trust")
+				r.opt.trustInput = true;
+			else if(tok == "fastwrite")
+				r.opt.fastWrite = true;
+			else if(!tok.compare(0, 5, "prio="))
+				r.prio = atoi(tok.c_str() + 5);
+			else if(!tok.compare(0, 6, "since="))
+				r.sincePath = tok.substr(6);
+			else if(!tok.compare(0, 5, "grid="))
+			{
+				if(!parseGrid(tok.c_str() + 5, r.opt))
+					return _reject(r, "error bad grid\n");
+			}
+			else
+			{
+				arg = line.substr(pos + 1); // rest of line, may contain spaces
+				break;
+			}
+			pos = end;
+		}
+		if(arg.empty())
+			return _reject(r, "error missing argument\n");
+
+		if(r.isFile)
+			r.path = arg;
+		else
+		{
+			char *endp;
+			const unsigned long long size = strtoull(arg.c_str(), &endp, 10);
+			if(*endp || size > MAX_PAYLOAD)
+				return _reject(r, "error bad size\n");
+			r.in.resize(size_t(size));
+			if(size && !_readAll(&r.in[0], r.in.size()))
+				return false;
+		}
+
+		r.opt.pool = &m_pool;
+		r.opt.priority = r.prio;
+		m_pool.add(new RequestJob(r), r.prio);
+		{
+			MutexLock lock(r.mtx);
+			while(!r.done)
+				r.cv.wait(r.mtx);
+		}
+
+		if(!r.ok)
+			return _send("error " + r.error + "\n");
+
+		char hdr[128];
+		if(r.isFile)
+			sprintf(hdr, "ok %.3f %.3f %.3f\n", r.stats.readMs, r.stats.processMs, r.stats.writeMs);
+		else
+			sprintf(hdr, "ok %.3f %.3f %.3f %lu\n", r.stats.readMs, r.stats.processMs, r.stats.writeMs, (unsigned long)r.out.size());
+		if(!_send(hdr))
+			return false;
+		return r.isFile || _sendRaw(&r.out[0], r.out.size());
+	}
+
+	bool _fill()
+	{
+		ssize_t n;
+		do
+			n = read(m_fd, m_buf, sizeof(m_buf));
+		while(n < 0 && errno == EINTR);
+		if(n <= 0)
+			return false;
+		m_bufPos = 0;
+		m_bufLen = n;
+		return true;
+	}
+
+	bool _readLine(std::string& line)
+	{
+		line.clear();
+		for(;;)
+		{
+			if(m_bufPos == m_bufLen && !_fill())
+				return false;
+			const char c = m_buf[m_bufPos++];
+			if(c == '\n')
+				break;
+			if(line.size() > 65536)
+				return false;
+			line += c;
+		}
+		if(!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		return true;
+	}
+
+	bool _readAll(unsigned char *dst, size_t size)
+	{
+		while(size)
+		{
+			if(m_bufPos == m_bufLen && !_fill())
+				return false;
+			size_t n = m_bufLen - m_bufPos;
+			if(n > size)
+				n = size;
+			memcpy(dst, m_buf + m_bufPos, n);
+			m_bufPos += n;
+			dst += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	bool _send(const std::string& s)
+	{
+		return _sendRaw(s.data(), s.size());
+	}
+
+	bool _sendRaw(const void *data, size_t size)
+	{
+		const char *p = (const char*)data;
+		while(size)
+		{
+			ssize_t n = write(m_fd, p, size);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				return false;
+			p += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	int m_fd;
+	ThreadPool& m_pool;
+	PlanCache *m_planCache;
+	Reaper& m_reaper;
+	char m_buf[64 * 1024];
+	size_t m_bufPos, m_bufLen;
+	Thread m_thread;
+};
+
+void Reaper::add(Connection *c)
+{
+	// Under the lock, so c can't be deleted before start() returns
+	MutexLock lock(m_mtx);
+	++m_live;
+	if(!c->start())
+	{
+		m_done.push_back(c);
+		m_cv.signal();
+	}
+}
+
+void Reaper::_run()
+{
+	for(;;)
+	{
+		std::list<Connection*> done;
+		{
+			MutexLock lock(m_mtx);
+			while(m_done.empty() && (m_live || !m_quit))
+				m_cv.wait(m_mtx);
+			if(m_done.empty())
+				return;
+			done.swap(m_done);
+			m_live -= done.size();
+		}
+		for(std::list<Connection*>::iterator it = done.begin(); it != done.end(); ++it)
+			delete *it;
+	}
+}
+
+} // end anonymous namespace
+
+int runServer(const char *socketPath, ThreadPool& pool, PlanCache *planCache)
+{
+	signal(SIGPIPE, SIG_IGN); // clients may go away at any time
+
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(socketPath) >= sizeof(addr.sun_path))
+	{
+		printf("Socket path too long: %s\n", socketPath);
+		return 1;
+	}
+	strcpy(addr.sun_path, socketPath);
+
+	int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(lfd < 0)
+	{
+		printf("Can't create socket\n");
+		return 1;
+	}
+	unlink(socketPath);
+	if(bind(lfd, (sockaddr*)&addr, sizeof(addr)) || listen(lfd, 64))
+	{
+		printf("Can't listen on %s\n", socketPath);
+		close(lfd);
+		return 1;
+	}
+	printf("Listening on %s with %u worker threads\n", socketPath, pool.size());
+	fflush(stdout);
+
+	Reaper reaper;
+	for(;;)
+	{
+		int fd = accept(lfd, NULL, NULL);
+		if(fd < 0)
+		{
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			printf("accept() failed\n");
+			break;
+		}
+		reaper.add(new Connection(fd, pool, planCache, reaper));
+	}
+
+	close(lfd);
+	unlink(socketPath);
+	return 1;
+}
+
+#endif
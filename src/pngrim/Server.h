@@ -0,0 +1,37 @@
+
+/* This code is released into the public domain. */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+class PlanCache;
+class ThreadPool;
+
+// Long-running mode: listen on a Unix domain socket and process requests
+// on the (already warm) worker pool until killed.
+//
+// Each request is a single header line, optionally followed by a payload:
+//
+//   file [fast|smooth] [trust] [fastwrite] [prio=N] [since=PREV] [grid=WxH] PATH\n   fix PATH in place
+//   data [fast|smooth] [trust] [fastwrite] [prio=N] [since=PREV] [grid=WxH] SIZE\n<SIZE bytes of PNG>
+//
+// Higher prio runs first (default 0), so interactive requests can overtake
+// queued batch work. 'trust' skips CRC checks like --trust-input, 'fastwrite'
+// is --fast-write, 'since' is --since (PREV can't contain spaces): an
+// editor that sends each save of a texture along with the previous result
+// only pays for refilling around the edit, the plan stays in memory.
+// 'smooth' is --smooth and 'grid' is --grid; both win over 'since'.
+// Replies are
+//
+//   ok READ_MS PROCESS_MS WRITE_MS\n                     for 'file'
+//   ok READ_MS PROCESS_MS WRITE_MS SIZE\n<SIZE bytes>    for 'data'
+//   error MESSAGE\n
+//
+// A connection may send any number of requests; they are answered in order.
+// A 'data' request with a bad header line gets its error, then the
+// connection is closed (the payload would be taken for more requests).
+// All requests share planCache, if given.
+// Returns the process exit code.
+int runServer(const char *socketPath, ThreadPool& pool, PlanCache *planCache);
+
+#endif
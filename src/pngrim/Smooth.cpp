@@ -0,0 +1,228 @@
+
+/* This code is released into the public domain. */
+
+#include "pngrim.h"
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "PixelTraits.h"
+
+namespace {
+
+// Scales of pngrimSmooth(): a Gaussian of SMOOTH_SIGMA pixels on each level
+// of an image pyramid (halved in size each time, so twice as wide as the
+// one before) until one covers the whole image. All of them together cost
+// little more than the first.
+const float SMOOTH_SIGMA = 1.0f;
+// A scale alone decides the color of a pixel once the smoothed alpha
+// weight there reaches this; below, coarser scales fill in the rest.
+const float SMOOTH_FULL_WEIGHT = 0.25f;
+// Adding and subtracting this flushes values far below 1 to zero. Over
+// empty areas the filters would decay into (slow) denormals otherwise.
+const float DENORMAL_GUARD = 1e-18f;
+
+inline float guard(float v)
+{
+	return (v + DENORMAL_GUARD) - DENORMAL_GUARD;
+}
+
+// Recursive Gaussian of Young and van Vliet: a forward and a backward
+// third order filter, the same few operations per pixel for any sigma
+// (0.5 and up).
+struct RecursiveGaussian
+{
+	explicit RecursiveGaussian(double sigma)
+	{
+		const double q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * sqrt(1 - 0.26891 * sigma);
+		const double q2 = q * q, q3 = q2 * q;
+		const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+		b1 = float((2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0);
+		b2 = float(-(1.4281 * q2 + 1.26661 * q3) / b0);
+		b3 = float(0.422205 * q3 / b0);
+		B = 1 - (b1 + b2 + b3);
+	}
+
+	float B, b1, b2, b3;
+};
+
+// Filters a row of w pixels of N floats in place, the channels side by
+// side. Outside the row is 0. The filter state is the pixels just done,
+// padded with 3 zero pixels on either side.
+template<unsigned N> void smoothRow(float *row, unsigned w, const RecursiveGaussian& g, std::vector<float>& pad)
+{
+	pad.assign((size_t(w) + 6) * N, 0.0f);
+	float * const p = &pad[3 * N];
+	std::copy(row, row + size_t(w) * N, p);
+	for(size_t i = 0; i < size_t(w) * N; ++i)
+		p[i] = guard(g.B * p[i] + g.b1 * p[i - N] + g.b2 * p[i - 2 * N] + g.b3 * p[i - 3 * N]);
+	for(size_t i = size_t(w) * N; i--; )
+		p[i] = guard(g.B * p[i] + g.b1 * p[i + N] + g.b2 * p[i + 2 * N] + g.b3 * p[i + 3 * N]);
+	std::copy(p, p + size_t(w) * N, row);
+}
+
+// The same down the columns, a row of all columns at a time: the filter
+// state is the rows just done.
+void smoothColumns(float *buf, size_t stride, unsigned h, const RecursiveGaussian& g)
+{
+	const std::vector<float> zero(stride, 0.0f);
+	for(unsigned y = 0; y < h; ++y)
+	{
+		float *r = buf + y * stride;
+		const float *r1 = y >= 1 ? r - stride : &zero[0];
+		const float *r2 = y >= 2 ? r - 2 * stride : &zero[0];
+		const float *r3 = y >= 3 ? r - 3 * stride : &zero[0];
+		for(size_t i = 0; i < stride; ++i)
+			r[i] = guard(g.B * r[i] + g.b1 * r1[i] + g.b2 * r2[i] + g.b3 * r3[i]);
+	}
+	for(unsigned y = h; y--; )
+	{
+		float *r = buf + y * stride;
+		const float *r1 = y + 1 < h ? r + stride : &zero[0];
+		const float *r2 = y + 2 < h ? r + 2 * stride : &zero[0];
+		const float *r3 = y + 3 < h ? r + 3 * stride : &zero[0];
+		for(size_t i = 0; i < stride; ++i)
+			r[i] = guard(g.B * r[i] + g.b1 * r1[i] + g.b2 * r2[i] + g.b3 * r3[i]);
+	}
+}
+
+// The next level of an image pyramid: every pixel the average of 2x2, a
+// missing row or column at the border counting as 0 like outside the image.
+template<unsigned N> void halve(const std::vector<float>& src, unsigned w, unsigned h, std::vector<float>& dst,
+                                unsigned& hw, unsigned& hh)
+{
+	hw = (w + 1) / 2;
+	hh = (h + 1) / 2;
+	dst.assign(size_t(hw) * hh * N, 0.0f);
+	for(unsigned y = 0; y < h; ++y)
+	{
+		const float *s = &src[size_t(y) * w * N];
+		float *d = &dst[size_t(y / 2) * hw * N];
+		for(unsigned x = 0; x < w; ++x)
+			for(unsigned c = 0; c < N; ++c)
+				d[(x / 2) * N + c] += 0.25f * s[size_t(x) * N + c];
+	}
+}
+
+// Bilinear sample of a pyramid level with w x h pixels at the center of
+// pixel (x, y) of the level below
+template<unsigned N> void sample(const float *level, unsigned w, unsigned h, unsigned x, unsigned y, float *v)
+{
+	const float fx = std::min(std::max(x * 0.5f - 0.25f, 0.0f), float(w - 1));
+	const float fy = std::min(std::max(y * 0.5f - 0.25f, 0.0f), float(h - 1));
+	const unsigned x0 = unsigned(fx), y0 = unsigned(fy);
+	const unsigned x1 = std::min(x0 + 1, w - 1), y1 = std::min(y0 + 1, h - 1);
+	const float ax = fx - x0, ay = fy - y0;
+	const float *p00 = level + (size_t(y0) * w + x0) * N, *p10 = level + (size_t(y0) * w + x1) * N;
+	const float *p01 = level + (size_t(y1) * w + x0) * N, *p11 = level + (size_t(y1) * w + x1) * N;
+	for(unsigned c = 0; c < N; ++c)
+		v[c] = (1 - ay) * ((1 - ax) * p00[c] + ax * p10[c]) + ay * ((1 - ax) * p01[c] + ax * p11[c]);
+}
+
+// The color of one scale at a pixel: its own (v, premultiplied, the alpha
+// weight last) as far as its weight goes, the rest from the coarser scale.
+template<unsigned C> inline void blend(const float *v, const float *coarser, bool last, float *out)
+{
+	const float a = v[C] > 0 ? (last ? 1.0f : std::min(1.0f, v[C] / SMOOTH_FULL_WEIGHT)) : 0.0f;
+	const float own = a > 0 ? a / v[C] : 0.0f;
+	for(unsigned c = 0; c < C; ++c)
+		out[c] = own * v[c] + (1 - a) * coarser[c];
+}
+
+template<class T> void rimSmooth(Image& img)
+{
+	enum { N = T::channels, C = T::colors }; // colors + alpha weight
+	const unsigned w = img.width();
+	const unsigned h = img.height();
+	const size_t n = img.numPixels();
+	typename T::Pixel * const px = img.pixels<typename T::Pixel>();
+
+	// Premultiplied colors and alpha weight
+	std::vector<std::vector<float> > levels(1, std::vector<float>(n * N));
+	std::vector<unsigned> lw(1, w), lh(1, h);
+	size_t numtrans = 0;
+	for(size_t i = 0; i < n; ++i)
+	{
+		float *v = &levels[0][i * N];
+		const float a = T::alpha(px[i]) * (1.0f / T::max);
+		for(unsigned c = 0; c < C; ++c)
+			v[c] = T::channel(px[i], c) * a;
+		v[C] = a;
+		numtrans += !T::alpha(px[i]);
+	}
+	// Nothing to fill, or nothing to spread the color of
+	if(!numtrans || numtrans == n)
+		return;
+	for(float sigma = SMOOTH_SIGMA; sigma < std::max(w, h); sigma *= 2)
+	{
+		levels.push_back(std::vector<float>());
+		lw.push_back(0);
+		lh.push_back(0);
+		const size_t l = levels.size() - 1;
+		halve<N>(levels[l - 1], lw[l - 1], lh[l - 1], levels[l], lw[l], lh[l]);
+	}
+
+	// Colors from the coarsest scale to the finest
+	const RecursiveGaussian g(SMOOTH_SIGMA);
+	std::vector<float> est, coarser, pad;
+	for(size_t l = levels.size(); l--; )
+	{
+		const unsigned w = lw[l], h = lh[l];
+		std::vector<float>& blurred = levels[l];
+		const size_t stride = size_t(w) * N;
+		for(unsigned y = 0; y < h; ++y)
+			smoothRow<N>(&blurred[y * stride], w, g, pad);
+		smoothColumns(&blurred[0], stride, h, g);
+
+		coarser.swap(est);
+		if(!l)
+			break;
+		est.resize(size_t(w) * h * C);
+		const bool last = l + 1 == levels.size();
+		for(unsigned y = 0; y < h; ++y)
+			for(unsigned x = 0; x < w; ++x)
+			{
+				const size_t i = size_t(y) * w + x;
+				float up[C];
+				if(last)
+					std::fill(up, up + C, 0.0f);
+				else
+					sample<C>(&coarser[0], lw[l + 1], lh[l + 1], x, y, up);
+				blend<C>(&blurred[i * N], up, last, &est[i * C]);
+			}
+	}
+
+	// The finest scale only for the transparent pixels, straight into img
+	for(unsigned y = 0; y < h; ++y)
+		for(unsigned x = 0; x < w; ++x)
+		{
+			const size_t i = size_t(y) * w + x;
+			if(T::alpha(px[i]))
+				continue;
+			float up[C], e[C];
+			if(levels.size() > 1)
+				sample<C>(&coarser[0], lw[1], lh[1], x, y, up);
+			else
+				std::fill(up, up + C, 0.0f);
+			blend<C>(&levels[0][i * N], up, levels.size() == 1, e);
+			typename T::Pixel v = 0;
+			for(unsigned c = 0; c < C; ++c)
+			{
+				const float f = std::min(std::max(e[c], 0.0f), float(T::max));
+				v |= T::place(unsigned(f + 0.5f), c);
+			}
+			px[i] = v;
+		}
+}
+
+} // end anonymous namespace
+
+void pngrimSmooth(Image& img)
+{
+	switch(img.format())
+	{
+		case PIXEL_RGBA8: rimSmooth<RGBA8Traits>(img); break;
+		case PIXEL_GA8: rimSmooth<GA8Traits>(img); break;
+		case PIXEL_RGBA16: rimSmooth<RGBA16Traits>(img); break;
+		case PIXEL_GA16: rimSmooth<GA16Traits>(img); break;
+	}
+}
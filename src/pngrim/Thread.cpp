@@ -0,0 +1,108 @@
+
+/* This code is released into the public domain. */
+
+#include "Thread.h"
+
+#ifndef _WIN32
+#  include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+Mutex::Mutex() { InitializeCriticalSection(&m_cs); }
+Mutex::~Mutex() { DeleteCriticalSection(&m_cs); }
+void Mutex::lock() { EnterCriticalSection(&m_cs); }
+void Mutex::unlock() { LeaveCriticalSection(&m_cs); }
+
+CondVar::CondVar() { InitializeConditionVariable(&m_cv); }
+CondVar::~CondVar() {}
+void CondVar::wait(Mutex& m) { SleepConditionVariableCS(&m_cv, &m.m_cs, INFINITE); }
+void CondVar::signal() { WakeConditionVariable(&m_cv); }
+void CondVar::broadcast() { WakeAllConditionVariable(&m_cv); }
+
+DWORD WINAPI Thread::_entry(LPVOID p)
+{
+	Thread *t = (Thread*)p;
+	t->m_func(t->m_arg);
+	return 0;
+}
+
+bool Thread::start(Func f, void *arg)
+{
+	if(m_running)
+		return false;
+	m_func = f;
+	m_arg = arg;
+	m_handle = CreateThread(NULL, 0, _entry, this, 0, NULL);
+	m_running = m_handle != NULL;
+	return m_running;
+}
+
+void Thread::join()
+{
+	if(!m_running)
+		return;
+	WaitForSingleObject(m_handle, INFINITE);
+	CloseHandle(m_handle);
+	m_running = false;
+}
+
+unsigned cpuCount()
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors ? si.dwNumberOfProcessors : 1;
+}
+
+#else // pthreads
+
+Mutex::Mutex() { pthread_mutex_init(&m_mtx, NULL); }
+Mutex::~Mutex() { pthread_mutex_destroy(&m_mtx); }
+void Mutex::lock() { pthread_mutex_lock(&m_mtx); }
+void Mutex::unlock() { pthread_mutex_unlock(&m_mtx); }
+
+CondVar::CondVar() { pthread_cond_init(&m_cv, NULL); }
+CondVar::~CondVar() { pthread_cond_destroy(&m_cv); }
+void CondVar::wait(Mutex& m) { pthread_cond_wait(&m_cv, &m.m_mtx); }
+void CondVar::signal() { pthread_cond_signal(&m_cv); }
+void CondVar::broadcast() { pthread_cond_broadcast(&m_cv); }
+
+void *Thread::_entry(void *p)
+{
+	Thread *t = (Thread*)p;
+	t->m_func(t->m_arg);
+	return NULL;
+}
+
+bool Thread::start(Func f, void *arg)
+{
+	if(m_running)
+		return false;
+	m_func = f;
+	m_arg = arg;
+	m_running = !pthread_create(&m_handle, NULL, _entry, this);
+	return m_running;
+}
+
+void Thread::join()
+{
+	if(!m_running)
+		return;
+	pthread_join(m_handle, NULL);
+	m_running = false;
+}
+
+unsigned cpuCount()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned)n : 1;
+}
+
+#endif
+
+Thread::Thread() : m_func(0), m_arg(0), m_running(false) {}
+
+Thread::~Thread()
+{
+	join();
+}
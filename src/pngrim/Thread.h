@@ -0,0 +1,100 @@
+
+/* This code is released into the public domain. */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#ifdef _WIN32
+#  if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0600
+#    undef _WIN32_WINNT
+#    define _WIN32_WINNT 0x0600 // condition variables need Vista
+#  endif
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
+
+// Minimal portable threading primitives (Win32 / pthreads).
+// Kept deliberately small; no exceptions, no C++11 requirement.
+
+class Mutex
+{
+	friend class CondVar;
+#ifdef _WIN32
+	CRITICAL_SECTION m_cs;
+#else
+	pthread_mutex_t m_mtx;
+#endif
+	Mutex(const Mutex&);
+	Mutex& operator=(const Mutex&);
+
+public:
+	Mutex();
+	~Mutex();
+	void lock();
+	void unlock();
+};
+
+class MutexLock
+{
+	Mutex& m_mtx;
+	MutexLock(const MutexLock&);
+	MutexLock& operator=(const MutexLock&);
+
+public:
+	MutexLock(Mutex& m) : m_mtx(m) { m_mtx.lock(); }
+	~MutexLock() { m_mtx.unlock(); }
+};
+
+class CondVar
+{
+#ifdef _WIN32
+	CONDITION_VARIABLE m_cv;
+#else
+	pthread_cond_t m_cv;
+#endif
+	CondVar(const CondVar&);
+	CondVar& operator=(const CondVar&);
+
+public:
+	CondVar();
+	~CondVar();
+	void wait(Mutex& m); // m must be locked
+	void signal();
+	void broadcast();
+};
+
+class Thread
+{
+public:
+	typedef void (*Func)(void *);
+
+	Thread();
+	~Thread(); // joins if still running
+
+	bool start(Func f, void *arg);
+	void join();
+	bool running() const { return m_running; }
+
+private:
+	Func m_func;
+	void *m_arg;
+	bool m_running;
+#ifdef _WIN32
+	HANDLE m_handle;
+	static DWORD WINAPI _entry(LPVOID p);
+#else
+	pthread_t m_handle;
+	static void *_entry(void *p);
+#endif
+	Thread(const Thread&);
+	Thread& operator=(const Thread&);
+};
+
+// Number of logical CPUs, at least 1.
+unsigned cpuCount();
+
+#endif
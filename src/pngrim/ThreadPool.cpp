@@ -0,0 +1,71 @@
+
+/* This code is released into the public domain. */
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned threads)
+: m_numThreads(threads ? threads : 1), m_busy(0), m_quit(false)
+{
+	m_threads = new Thread[m_numThreads];
+	for(unsigned i = 0; i < m_numThreads; ++i)
+		m_threads[i].start(_workerThread, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	wait();
+	{
+		MutexLock lock(m_mtx);
+		m_quit = true;
+		m_workCV.broadcast();
+	}
+	delete [] m_threads;
+}
+
+void ThreadPool::add(Job *job, int priority)
+{
+	MutexLock lock(m_mtx);
+	m_queue[priority].push_back(job);
+	m_workCV.signal();
+}
+
+void ThreadPool::wait()
+{
+	MutexLock lock(m_mtx);
+	while(m_busy || !m_queue.empty())
+		m_idleCV.wait(m_mtx);
+}
+
+void ThreadPool::_workerThread(void *self)
+{
+	((ThreadPool*)self)->_workerLoop();
+}
+
+void ThreadPool::_workerLoop()
+{
+	m_mtx.lock();
+	for(;;)
+	{
+		while(!m_quit && m_queue.empty())
+			m_workCV.wait(m_mtx);
+		if(m_quit)
+			break;
+
+		Queue::iterator top = m_queue.begin();
+		Job *job = top->second.front();
+		top->second.pop_front();
+		if(top->second.empty())
+			m_queue.erase(top);
+		++m_busy;
+		m_mtx.unlock();
+
+		job->run();
+		delete job;
+
+		m_mtx.lock();
+		--m_busy;
+		if(!m_busy && m_queue.empty())
+			m_idleCV.broadcast();
+	}
+	m_mtx.unlock();
+}
@@ -0,0 +1,47 @@
+
+/* This code is released into the public domain. */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <deque>
+#include <map>
+#include <functional>
+#include "Thread.h"
+
+class Job
+{
+public:
+	virtual ~Job() {}
+	virtual void run() = 0;
+};
+
+// Fixed set of worker threads running Jobs, highest priority first and
+// FIFO within the same priority.
+// The pool takes ownership of added jobs and deletes them after running.
+class ThreadPool
+{
+public:
+	ThreadPool(unsigned threads);
+	~ThreadPool(); // waits for all jobs, then stops the workers
+
+	void add(Job *job, int priority = 0);
+	void wait(); // blocks until the queue is empty and all workers are idle
+
+	unsigned size() const { return m_numThreads; }
+
+private:
+	static void _workerThread(void *self);
+	void _workerLoop();
+
+	Thread *m_threads;
+	unsigned m_numThreads;
+	unsigned m_busy;
+	bool m_quit;
+	typedef std::map<int, std::deque<Job*>, std::greater<int> > Queue;
+	Queue m_queue; // never holds empty deques
+	Mutex m_mtx;
+	CondVar m_workCV, m_idleCV;
+};
+
+#endif
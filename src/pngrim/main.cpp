@@ -3,59 +3,232 @@
 
 #include <string.h>
 #include <stdio.h>
-#include "ImagePNG.h"
-#include "pngrim.h"
+#include <stdlib.h>
+#include <vector>
+#include "FileLoader.h"
+#include "FileScanner.h"
+#include "PlanCache.h"
+#include "Process.h"
+#include "Server.h"
+#include "ThreadPool.h"
 
-void processImage(Image& img, bool fast)
-{
-	if(fast)
-		pngrimFast(img);
-	else
-		pngrimAccurate(img);
-}
+// Files are read ahead by this many I/O threads, holding at most
+// LOAD_WINDOW complete files in memory (per worker thread).
+static const unsigned LOAD_THREADS = 4;
+static const unsigned LOAD_WINDOW = 8;
+// Memory for fill plans of both engines, shared by all worker threads.
+static const size_t PLAN_CACHE_BYTES = 64 << 20;
 
-void processFile(const char *fn, bool fast)
+void processFile(const LoadedFile& f, const ProcessOptions& opt)
 {
-	Image img;
-	if(!img.readPNG(fn))
+	const char *fn = f.name.c_str();
+	if(!f.ok)
 	{
+		printf("[read_png_file] File %s could not be opened for reading\n", fn);
 		printf("File not processed: %s\n", fn);
 		return;
 	}
 
-	printf("Processing %s ... ", fn);
-	fflush(stdout);
-	processImage(img, fast);
-	printf("saving ... ");
-	fflush(stdout);
+	std::vector<unsigned char> out;
+	ProcessStats stats;
+	if(!processBuffer(f.data.empty() ? NULL : &f.data[0], f.data.size(), fn, opt, out, &stats))
+	{
+		printf("File not processed: %s\n", fn);
+		return;
+	}
 
-	if(img.writePNG(fn))
-		printf("OK\n");
+	// Several files may be in flight at once, print each result in one go
+	if(FileLoader::writeFile(fn, out))
+	{
+		if(stats.encoder.empty())
+			printf("Processing %s ... saving ... OK\n", fn);
+		else
+			printf("Processing %s ... saving ... OK [%s]\n", fn, stats.encoder.c_str());
+	}
 	else
-		printf("Failed to write!\n");
+		printf("Processing %s ... saving ... Failed to write!\n", fn);
+}
+
+class ProcessJob : public Job
+{
+	FileLoader& m_loader;
+	LoadedFile *m_file;
+	const ProcessOptions& m_opt;
+public:
+	ProcessJob(FileLoader& loader, LoadedFile *f, const ProcessOptions& opt) : m_loader(loader), m_file(f), m_opt(opt) {}
+	virtual void run()
+	{
+		processFile(*m_file, m_opt);
+		m_loader.release(m_file);
+	}
+};
+
+static void scanFound(const char *path, void *loader)
+{
+	((FileLoader*)loader)->add(path);
 }
 
+static void scanDone(void *loader)
+{
+	((FileLoader*)loader)->finish();
+}
+
+static void usage()
+{
+	printf("Usage: ./pngrim [options] file1.png [fileX.png ...]\n");
+	printf("Options:\n");
+	printf("  --fast             Use the fast (distance based) algorithm\n");
+	printf("  --smooth           Blur colors into transparent areas (smoother, for mipmaps)\n");
+	printf("  --plan-cache DIR   Keep fill plans in DIR, for images sharing alpha\n");
+	printf("  --since PREV       Redo only what changed since PREV, the earlier output\n");
+	printf("                     for the one input file (same --fast and --plan-cache)\n");
+	printf("  --grid WxH         Fill each W x H pixel cell of a sprite sheet on its own,\n");
+	printf("                     in parallel (idle worker threads help with the cells)\n");
+	printf("  -j N               Number of worker threads (default: number of CPUs)\n");
+	printf("  -r DIR             Process all matching files in DIR, recursively\n");
+	printf("  --include GLOB     File name pattern for -r (default: *.png)\n");
+	printf("  -@ LIST, --files-from LIST\n");
+	printf("                     Read NUL-separated file names from LIST (- = stdin)\n");
+	printf("  --optimize         Try several filter/zlib settings, keep the smallest file\n");
+	printf("  --optimize-time MS Time budget per image for --optimize\n");
+	printf("  --fast-write       Encode for speed, not size (overrides --optimize)\n");
+	printf("  --trust-input      Skip CRC checks when reading (files known to be intact)\n");
+	printf("  --serve SOCKET     Run as a server on a Unix domain socket (see Server.h)\n");
+	printf("Warning: Modifies files in place!\n");
+}
 
 int main(int argc, char **argv)
 {
 	if(argc <= 1)
 	{
-		printf("Usage: ./pngrim [--fast] file1.png [fileX.png ...]\n");
-		printf("Warning: Modifies files in place!\n");
+		usage();
 		return 2;
 	}
 
-	int begin = 1;
-	bool fast = false;
-	if(!strcmp(argv[1], "--fast"))
+	ProcessOptions opt;
+	unsigned threads = cpuCount();
+	const char *pattern = NULL;
+	const char *serve = NULL;
+	const char *planDir = NULL;
+	const char *since = NULL;
+	std::vector<const char*> files, dirs, lists;
+
+	for(int i = 1; i < argc; ++i)
+	{
+		const char *a = argv[i];
+		const bool hasArg = i + 1 < argc;
+		if(!strcmp(a, "--"))
+		{
+			while(++i < argc)
+				files.push_back(argv[i]);
+		}
+		else if(!strcmp(a, "--fast"))
+			opt.fast = true;
+		else if(!strcmp(a, "--smooth"))
+			opt.smooth = true;
+		else if(!strcmp(a, "--trust-input"))
+			opt.trustInput = true;
+		else if(!strcmp(a, "--optimize"))
+			opt.optimize = true;
+		else if(!strcmp(a, "--fast-write"))
+			opt.fastWrite = true;
+		else if(!strcmp(a, "--optimize-time") && hasArg)
+			opt.optimizeMs = atof(argv[++i]);
+		else if(!strcmp(a, "-j") && hasArg)
+			threads = atoi(argv[++i]);
+		else if(!strcmp(a, "-r") && hasArg)
+			dirs.push_back(argv[++i]);
+		else if(!strcmp(a, "--include") && hasArg)
+			pattern = argv[++i];
+		else if((!strcmp(a, "-@") || !strcmp(a, "--files-from")) && hasArg)
+			lists.push_back(argv[++i]);
+		else if(!strcmp(a, "--serve") && hasArg)
+			serve = argv[++i];
+		else if(!strcmp(a, "--plan-cache") && hasArg)
+			planDir = argv[++i];
+		else if(!strcmp(a, "--since") && hasArg)
+			since = argv[++i];
+		else if(!strcmp(a, "--grid") && hasArg)
+		{
+			if(!parseGrid(argv[++i], opt))
+			{
+				printf("Bad grid (expected WxH): %s\n", argv[i]);
+				return 2;
+			}
+		}
+		else if(a[0] == '-' && a[1])
+		{
+			printf("Unknown or incomplete option: %s\n", a);
+			usage();
+			return 2;
+		}
+		else
+			files.push_back(a);
+	}
+	if(!threads)
+		threads = 1;
+	// Files already run in parallel; split the remaining cores among trials
+	opt.trialThreads = (cpuCount() + threads - 1) / threads;
+
+	// Plans are reused across files with the same transparent pixels. Those
+	// of the accurate engine cost it an extra analysis, so it only keeps
+	// them for a plan directory (the server sets its own options).
+	PlanCache planCache(PLAN_CACHE_BYTES, planDir);
+	opt.planCache = &planCache;
+	opt.accuratePlans = planDir != NULL;
+
+	std::vector<unsigned char> sinceData;
+	if(since)
+	{
+		if(files.size() != 1 || !dirs.empty() || !lists.empty() || serve)
+		{
+			printf("--since needs exactly one input file\n");
+			return 2;
+		}
+		if(opt.gridWidth || opt.smooth)
+		{
+			printf("--since can't be combined with --grid or --smooth\n");
+			return 2;
+		}
+		// A new process has no plans in memory
+		if(!planDir)
+		{
+			printf("--since needs --plan-cache DIR, where the run that made PREV kept its plan\n");
+			return 2;
+		}
+		if(!FileLoader::readFile(since, sinceData))
+		{
+			printf("[read_png_file] File %s could not be opened for reading\n", since);
+			return 1;
+		}
+		opt.since = sinceData.empty() ? NULL : &sinceData[0];
+		opt.sinceSize = sinceData.size();
+	}
+
+	if(serve)
 	{
-		begin = 2;
-		fast = true;
+		ThreadPool pool(threads);
+		return runServer(serve, pool, &planCache);
 	}
 
-	for(int i = begin; i < argc; ++i)
-		processFile(argv[i], fast);
+	FileLoader loader(LOAD_THREADS, LOAD_WINDOW * threads);
+	ThreadPool pool(threads);
+	opt.pool = &pool;
+	FileScanner scanner(pool, scanFound, scanDone, &loader);
+	if(pattern)
+		scanner.setPattern(pattern);
+
+	for(size_t i = 0; i < files.size(); ++i)
+		loader.add(files[i]);
+	for(size_t i = 0; i < dirs.size(); ++i)
+		scanner.addDir(dirs[i]);
+	for(size_t i = 0; i < lists.size(); ++i)
+		scanner.addList(lists[i]);
+	scanner.close(); // finishes the loader once all scanning is done
+
+	while(LoadedFile *f = loader.next())
+		pool.add(new ProcessJob(loader, f, opt));
+	pool.wait();
 
 	return 0;
 }
-
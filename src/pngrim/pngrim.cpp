@@ -2,8 +2,11 @@
 /* This code is released into the public domain. */
 
 #include <algorithm>
-#include "ImagePNG.h"
-#include "Matrix.h"
+#include <functional>
+#include <queue>
+#include "pngrim.h"
+#include "PixelTraits.h"
+#include "PlanCache.h"
 
 
 struct Pos
@@ -17,43 +20,182 @@ struct Pos
 	}
 };
 
-inline unsigned red  (unsigned c) { return (c      ) & 0xff; }
-inline unsigned green(unsigned c) { return (c >> 8 ) & 0xff; }
-inline unsigned blue (unsigned c) { return (c >> 16) & 0xff; }
-inline unsigned alpha(unsigned c) { return (c >> 24) & 0xff; }
+// Sum of the color channels of some pixels, for their average
+template<class T> struct ColorSum
+{
+	typename T::Sum sum[T::colors];
+	unsigned count;
+
+	ColorSum() : count(0)
+	{
+		for(unsigned i = 0; i < T::colors; ++i)
+			sum[i] = 0;
+	}
+	inline void add(typename T::Pixel pix)
+	{
+		for(unsigned i = 0; i < T::colors; ++i)
+			sum[i] += T::channel(pix, i);
+		++count;
+	}
+	// Average color with alpha 0
+	inline typename T::Pixel average() const
+	{
+		typename T::Pixel v = 0;
+		for(unsigned i = 0; i < T::colors; ++i)
+			v |= T::place(sum[i] / count, i);
+		return v;
+	}
+};
 
 template<typename T> inline T vmin(T a, T b) { return a < b ? a : b; }
 template<typename T> inline T vmax(T a, T b) { return a > b ? a : b; }
 
-void pngrimAccurate(Image& img)
+const int NEIGHBOURS[8][2] =
+{
+	{-1, -1}, {0, -1}, {1, -1},
+	{-1,  0},          {1,  0},
+	{-1,  1}, {0,  1}, {1,  1}
+};
+
+// Index into NEIGHBOURS, for ox, oy in [-1, 1] and not both 0.
+// The opposite direction of k is 7 - k.
+inline unsigned neighbourIndex(int ox, int oy)
+{
+	const unsigned i = (oy + 1) * 3 + (ox + 1);
+	return i > 4 ? i - 1 : i;
+}
+
+// Appends the runs of transparent pixels in a row to spans, returns their
+// number of pixels
+template<class T> unsigned findSpans(const typename T::Pixel *src, unsigned w, std::vector<Span>& spans)
+{
+	unsigned n = 0;
+	unsigned x = 0;
+	for(;;)
+	{
+		while(x < w && T::alpha(src[x]))
+			++x;
+		if(x == w)
+			return n;
+		Span s;
+		s.begin = x;
+		while(x < w && !T::alpha(src[x]))
+			++x;
+		s.end = x;
+		spans.push_back(s);
+		n += s.end - s.begin;
+	}
+}
+
+// The parts of the runs [b, e) of a row that are at least a pixel from
+// their ends, the image border not counting as an end.
+void innerSpans(const Span *b, const Span *e, unsigned w, std::vector<Span>& out)
+{
+	out.clear();
+	for(; b != e; ++b)
+	{
+		const unsigned begin = b->begin ? b->begin + 1 : 0;
+		const unsigned end = b->end < w ? b->end - 1 : w;
+		if(begin < end)
+			out.push_back(Span(begin, end));
+	}
+}
+
+void intersectSpans(const std::vector<Span>& a, const std::vector<Span>& b, std::vector<Span>& out)
+{
+	out.clear();
+	std::vector<Span>::const_iterator i = a.begin(), j = b.begin();
+	while(i != a.end() && j != b.end())
+	{
+		const unsigned begin = std::max(i->begin, j->begin);
+		const unsigned end = std::min(i->end, j->end);
+		if(begin < end)
+			out.push_back(Span(begin, end));
+		if(i->end < j->end)
+			++i;
+		else
+			++j;
+	}
+}
+
+// Records what it does in plan, if given.
+template<class T> void rimAccurate(Image& img, FillPlan *plan)
 {
 	const unsigned w = img.width();
 	const unsigned h = img.height();
+	typename T::Pixel * const px = img.pixels<typename T::Pixel>();
 	Matrix<unsigned char> solid(w, h);
 	std::vector<Pos> P, Q, R;
+	size_t numtrans = 0;
 
+	std::vector<Span> spans;
+	std::vector<size_t> rowSpans(1, 0);
+	rowSpans.reserve(h + 1);
 	for(unsigned y = 0; y < h; ++y)
-		for(unsigned x = 0; x < w; ++x)
-		{
-			if(alpha(img(x, y)))
-				solid(x, y) = 1;
+	{
+		numtrans += findSpans<T>(px + size_t(y) * w, w, spans);
+		rowSpans.push_back(spans.size());
+	}
+
+	// Only the transparent pixels next to an opaque one start out in P,
+	// those deep inside a run of rows y-1, y and y+1 are skipped unread.
+	std::vector<Span> inner[3], deep, tmp;
+	for(unsigned y = 0; y < h; ++y)
+	{
+		std::fill(&solid(0, y), &solid(0, y) + w, 1);
+		const Span *b = spans.empty() ? 0 : &spans[0] + rowSpans[y];
+		const Span *e = spans.empty() ? 0 : &spans[0] + rowSpans[y + 1];
+		if(b == e)
+			continue;
+		for(unsigned i = 0; i < 3; ++i)
+			if(y + i - 1 < h)
+				innerSpans(&spans[0] + rowSpans[y + i - 1], &spans[0] + rowSpans[y + i], w, inner[i]);
 			else
+				inner[i].assign(1, Span(0, w));
+		intersectSpans(inner[0], inner[1], tmp);
+		intersectSpans(tmp, inner[2], deep);
+
+		std::vector<Span>::const_iterator d = deep.begin();
+		for(const Span *s = b; s != e; ++s)
+		{
+			std::fill(&solid(s->begin, y), &solid(s->begin, y) + (s->end - s->begin), 0);
+			for(unsigned x = s->begin; x < s->end; ++x)
 			{
+				while(d != deep.end() && d->end <= x)
+					++d;
+				if(d != deep.end() && d->begin <= x)
+				{
+					x = d->end - 1;
+					continue;
+				}
 				Pos p(x, y, 0);
-				solid(x, y) = 0;
 				for(int oy = -1; oy <= 1; ++oy)
 					for(int ox = -1; ox <= 1; ++ox)
 					{
 						const unsigned xn = int(x) + ox;
 						const unsigned yn = int(y) + oy;
-						if(xn < w && yn < h && alpha(img(xn, yn)))
+						if(xn < w && yn < h && T::alpha(px[size_t(yn) * w + xn]))
 							++p.nb;
 					}
 
-					if(p.nb)
-						P.push_back(p);
+				if(p.nb)
+					P.push_back(p);
 			}
 		}
+	}
+
+	if(plan)
+	{
+		plan->width = w;
+		plan->height = h;
+		plan->numtrans = numtrans;
+		plan->accurate = true;
+		if(numtrans < img.numPixels())
+		{
+			plan->pixels.reserve(numtrans);
+			plan->neighbours.reserve(numtrans);
+		}
+	}
 
 	while(P.size())
 	{
@@ -62,10 +204,8 @@ void pngrimAccurate(Image& img)
 
 		while(Q.size())
 		{
-			unsigned r = 0;
-			unsigned g = 0;
-			unsigned b = 0;
-			unsigned c = 0;
+			ColorSum<T> sum;
+			unsigned mask = 0;
 			Pos p = Q.back();
 			Q.pop_back();
 			if(solid(p.x, p.y))
@@ -85,11 +225,8 @@ void pngrimAccurate(Image& img)
 							{
 								if(solid(x, y))
 								{
-									const unsigned pix = img(x, y);
-									r +=   red(pix);
-									g += green(pix);
-									b +=  blue(pix);
-									++c;
+									sum.add(px[size_t(y) * w + x]);
+									mask |= 1 << neighbourIndex(ox, oy);
 								}
 								else
 									R.push_back(Pos(x, y, 0));
@@ -100,10 +237,12 @@ void pngrimAccurate(Image& img)
 			}
 
 			solid(p.x, p.y) = 1;
-			img(p.x, p.y) =
-				  ((r / c)      )
-				| ((g / c) << 8 )
-				| ((b / c) << 16);
+			px[size_t(p.y) * w + p.x] = sum.average();
+			if(plan)
+			{
+				plan->pixels.push_back(p.y * w + p.x);
+				plan->neighbours.push_back((unsigned char)mask);
+			}
 		}
 
 		while(R.size())
@@ -127,105 +266,403 @@ void pngrimAccurate(Image& img)
 	}
 }
 
-void pngrimFast(Image& img)
+void FastAnalysis::begin(unsigned w, unsigned h)
+{
+	dist.resize(w, h);
+	spans.clear();
+	rowSpans.assign(1, 0);
+	rowSpans.reserve(h + 1);
+	numtrans = 0;
+	maskHash = 0;
+}
+
+void FastAnalysis::row(const Image& img, unsigned y)
 {
 	const unsigned w = img.width();
-	const unsigned h = img.height();
 	const unsigned inf = 0x7fffffff;
-	Matrix<unsigned> dist(w, h);
+	unsigned * const row = &dist(0, y);
+	const size_t offset = size_t(y) * w;
 
-	unsigned numtrans = 0;
-	for(unsigned y = 0; y < h; ++y)
-		for(unsigned x = 0; x < w; ++x)
+	switch(img.format())
+	{
+		case PIXEL_RGBA8:
+			numtrans += findSpans<RGBA8Traits>(img.pixels<unsigned int>() + offset, w, spans);
+			break;
+		case PIXEL_GA8:
+			numtrans += findSpans<GA8Traits>(img.pixels<unsigned short>() + offset, w, spans);
+			break;
+		case PIXEL_RGBA16:
+			numtrans += findSpans<RGBA16Traits>(img.pixels<unsigned long long>() + offset, w, spans);
+			break;
+		case PIXEL_GA16:
+			numtrans += findSpans<GA16Traits>(img.pixels<unsigned int>() + offset, w, spans);
+			break;
+	}
+	rowSpans.push_back(spans.size());
+	const Span *first = spansBegin(y), *last = spansEnd(y);
+
+	// 64 pixels per step into the hash, bit i set for transparent x + i
+	const Span *s = first;
+	for(unsigned x = 0; x < w; x += 64)
+	{
+		const unsigned end = vmin(x + 64, w);
+		unsigned long long bits = 0;
+		for(; s != last && s->begin < end; ++s)
 		{
-			const unsigned isTrans = !alpha(img(x, y));
-			dist(x, y) = isTrans;
-			numtrans += isTrans;
+			const unsigned b = vmax(s->begin, x), e = vmin(s->end, end);
+			bits |= (e - b == 64 ? ~0ULL : (1ULL << (e - b)) - 1) << (b - x);
+			if(s->end > end)
+				break;
 		}
-	std::vector<Pos> todo;
-	todo.reserve(numtrans);
+		maskHash = (maskHash ^ bits) * 0x9e3779b97f4a7c15ULL;
+		maskHash ^= maskHash >> 29;
+	}
 
-	// distance transform, X direction
-	for(unsigned y = 0; y < h; ++y)
+	// distance transform, X direction: the distance to the nearest opaque
+	// pixel in the row, counted from inf past the row ends, except that the
+	// first pixel only looks to the left
+	std::fill(row, row + w, 0u);
+	for(s = first; s != last; ++s)
 	{
-		unsigned * const row = &dist(0, y);
-		unsigned d = inf;
-		for(unsigned x = 0; x < w; ++x)
-			if(row[x])
-				row[x] = ++d;
-			else
-				d = 0;
-		d = inf;
-		for(unsigned x = w-1; x; --x)
-			if(const unsigned val = row[x])
-				row[x] = vmin(++d, val);
-			else
-				d = 0;
+		const unsigned b = s->begin, e = s->end;
+		const unsigned left = b ? 1 - b : inf + 1; // + x
+		const unsigned right = e < w ? e : inf + w; // - x
+		unsigned x = b;
+		if(!x)
+			row[x++] = left;
+		for(; x < e; ++x)
+			row[x] = vmin(left + x, right - x);
 	}
+}
 
-	// distance transform, Y direction
+// One row of the distance transform in Y direction; d holds the distance
+// carried along each column.
+inline void distanceStepY(unsigned *row, unsigned *d, unsigned w)
+{
 	for(unsigned x = 0; x < w; ++x)
 	{
-		unsigned d = dist(x, 0);
-		for(unsigned y = 0; y < h; ++y)
-		{
-			const unsigned val = dist(x, y);
-			if(val >= d)
-				dist(x, y) = vmin(++d, val);
-			else
-				d = val;
-		}
-		d = dist(x, h-1);
-		for(unsigned y = h-1; y; --y)
-		{
-			const unsigned val = dist(x, y);
-			if(val >= d)
-				dist(x, y) = vmin(++d, val);
-			else
-				d = val;
-		}
+		const unsigned val = row[x], next = d[x] + 1;
+		const bool carry = val >= d[x];
+		row[x] = carry ? vmin(next, val) : val;
+		d[x] = carry ? next : val;
 	}
+}
+
+// Second phase of pngrimFast(); uses up pre->dist. Records what it does
+// in plan, if given.
+template<class T> void rimFast(Image& img, FastAnalysis *pre, FillPlan *plan)
+{
+	const unsigned w = img.width();
+	const unsigned h = img.height();
+	typename T::Pixel * const px = img.pixels<typename T::Pixel>();
+	Matrix<unsigned>& dist = pre->dist;
+
+	if(plan)
+	{
+		plan->width = w;
+		plan->height = h;
+		plan->numtrans = pre->numtrans;
+		plan->accurate = false;
+	}
+	// Nothing to spread the color of, or nothing to fill
+	if(pre->numtrans == img.numPixels() || !pre->numtrans)
+		return;
+	if(plan)
+	{
+		plan->pixels.reserve(pre->numtrans);
+		plan->neighbours.reserve(pre->numtrans);
+	}
+
+	std::vector<Pos> todo;
+	todo.reserve(pre->numtrans);
+
+	// distance transform, Y direction, a row of all columns at a time
+	std::vector<unsigned> d(&dist(0, 0), &dist(0, 0) + w);
+	for(unsigned y = 0; y < h; ++y)
+		distanceStepY(&dist(0, y), &d[0], w);
+	d.assign(&dist(0, h-1), &dist(0, h-1) + w);
+	for(unsigned y = h-1; y; --y)
+		distanceStepY(&dist(0, y), &d[0], w);
 
 	// Use distance as heuristic for pixel processing order
 	for(unsigned y = 0; y < h; ++y)
-		for(unsigned x = 0; x < w; ++x)
-			if(unsigned d = dist(x, y))
-				todo.push_back(Pos(x, y, d));
+		for(const Span *s = pre->spansBegin(y); s != pre->spansEnd(y); ++s)
+			for(unsigned x = s->begin; x < s->end; ++x)
+				todo.push_back(Pos(x, y, dist(x, y)));
 	std::sort(todo.begin(), todo.end());
 
 	for(size_t i = 0; i < todo.size(); ++i)
 	{
 		Pos p = todo[i];
-		unsigned r = 0, g = 0, b = 0, c = 0;
+		ColorSum<T> sum;
+		unsigned mask = 0;
 
-		for(int oy = -1; oy <= 1; ++oy)
+		for(unsigned k = 0; k < 8; ++k)
 		{
-			const unsigned y = int(p.y) + oy;
-			if(y < h)
+			const unsigned x = int(p.x) + NEIGHBOURS[k][0];
+			const unsigned y = int(p.y) + NEIGHBOURS[k][1];
+			if(x < w && y < h && !dist(x, y))
 			{
-				for(int ox = -1; ox <= 1; ++ox)
-				{
-					const unsigned x = int(p.x) + ox;
-					if(x < w)
-					{
-						if((ox || oy) && !dist(x, y))
-						{
-							const unsigned pix = img(x, y);
-							r +=   red(pix);
-							g += green(pix);
-							b +=  blue(pix);
-							++c;
-						}
-					}
-				}
+				sum.add(px[size_t(y) * w + x]);
+				mask |= 1 << k;
 			}
 		}
 
 		dist(p.x, p.y) = 0;
-		img(p.x, p.y) =
-			  ((r / c)      )
-			| ((g / c) << 8 )
-			| ((b / c) << 16);
+		px[size_t(p.y) * w + p.x] = sum.average();
+		if(plan)
+		{
+			plan->pixels.push_back(p.y * w + p.x);
+			plan->neighbours.push_back((unsigned char)mask);
+		}
+	}
+}
+
+bool planMatches(const FillPlan& plan, const FastAnalysis& pre)
+{
+	const unsigned w = (unsigned)pre.dist.width();
+	const unsigned h = (unsigned)pre.dist.height();
+	if(plan.width != w || plan.height != h || plan.numtrans != pre.numtrans)
+		return false;
+	if(plan.pixels.empty())
+		return !pre.numtrans || pre.numtrans == size_t(w) * h;
+	if(plan.pixels.size() != pre.numtrans)
+		return false;
+	// As many distinct pixels as there are transparent ones, so all of
+	// them being transparent means it is the same set
+	for(size_t i = 0; i < plan.pixels.size(); ++i)
+		if(!pre.dist(plan.pixels[i] % w, plan.pixels[i] / w))
+			return false;
+	return true;
+}
+
+template<class T> void applyFill(Image& img, const FillPlan& plan)
+{
+	const ptrdiff_t w = img.width();
+	typename T::Pixel * const px = img.pixels<typename T::Pixel>();
+	ptrdiff_t offset[8];
+	for(unsigned k = 0; k < 8; ++k)
+		offset[k] = NEIGHBOURS[k][1] * w + NEIGHBOURS[k][0];
+
+	for(size_t i = 0; i < plan.pixels.size(); ++i)
+	{
+		typename T::Pixel * const p = px + plan.pixels[i];
+		const unsigned mask = plan.neighbours[i];
+		ColorSum<T> sum;
+		for(unsigned k = 0; k < 8; ++k)
+			if(mask & (1 << k))
+				sum.add(p[offset[k]]);
+		*p = sum.average();
+	}
+}
+
+void applyFillPlan(Image& img, const FillPlan& plan)
+{
+	switch(img.format())
+	{
+		case PIXEL_RGBA8: applyFill<RGBA8Traits>(img, plan); break;
+		case PIXEL_GA8: applyFill<GA8Traits>(img, plan); break;
+		case PIXEL_RGBA16: applyFill<RGBA16Traits>(img, plan); break;
+		case PIXEL_GA16: applyFill<GA16Traits>(img, plan); break;
+	}
+}
+
+// updateFill() only follows the changes of at most 1 / UPDATE_MAX_CHANGED
+// of all pixels.
+const unsigned UPDATE_MAX_CHANGED = 64;
+
+// Redoes the fill steps of plan that depend on colors that differ between
+// img and prev, in plan order; the other filled pixels are taken from prev.
+// False, with img untouched, if prev has other transparent pixels.
+template<class T> bool updateFill(Image& img, const Image& prev, const FillPlan& plan)
+{
+	typedef typename T::Pixel Pixel;
+	const unsigned w = img.width();
+	const unsigned h = img.height();
+	const size_t n = size_t(w) * h;
+	if(prev.width() != w || prev.height() != h || prev.format() != img.format())
+		return false;
+	// Nothing is filled, so nothing can have changed
+	if(plan.pixels.empty())
+		return true;
+
+	Pixel * const px = img.pixels<Pixel>();
+	const Pixel * const old = prev.pixels<Pixel>();
+	const Pixel colors = Pixel(~T::place(T::max, T::colors));
+	std::vector<unsigned> changed;
+	for(size_t i = 0; i < n; ++i)
+	{
+		const bool solid = T::alpha(px[i]) != 0;
+		if(solid != (T::alpha(old[i]) != 0))
+			return false;
+		if(solid && ((px[i] ^ old[i]) & colors))
+			changed.push_back(unsigned(i));
+	}
+	// Past this, going through the steps one by one is cheaper
+	if(changed.size() > n / UPDATE_MAX_CHANGED)
+	{
+		applyFill<T>(img, plan);
+		return true;
+	}
+
+	// step[i]: 1 + position of pixel i in the plan, 0 for solid pixels
+	std::vector<unsigned> step(n, 0);
+	for(size_t s = 0; s < plan.pixels.size(); ++s)
+	{
+		const unsigned i = plan.pixels[s];
+		step[i] = unsigned(s + 1);
+		px[i] = old[i];
+	}
+
+	// Steps that read a changed pixel, lowest first; each redone step can
+	// only affect later ones
+	std::priority_queue<unsigned, std::vector<unsigned>, std::greater<unsigned> > todo;
+	std::vector<bool> queued(plan.pixels.size());
+	for(size_t c = 0; c < changed.size(); ++c)
+	{
+		const unsigned x = changed[c] % w, y = changed[c] / w;
+		for(unsigned k = 0; k < 8; ++k)
+		{
+			const unsigned xn = int(x) + NEIGHBOURS[k][0];
+			const unsigned yn = int(y) + NEIGHBOURS[k][1];
+			if(xn >= w || yn >= h)
+				continue;
+			const unsigned s = step[size_t(yn) * w + xn];
+			if(s && (plan.neighbours[s - 1] & (1 << (7 - k))) && !queued[s - 1])
+			{
+				queued[s - 1] = true;
+				todo.push(s - 1);
+			}
+		}
 	}
+
+	while(!todo.empty())
+	{
+		const unsigned s = todo.top();
+		todo.pop();
+		const unsigned i = plan.pixels[s];
+		const unsigned x = i % w, y = i / w;
+		const unsigned mask = plan.neighbours[s];
+		ColorSum<T> sum;
+		for(unsigned k = 0; k < 8; ++k)
+			if(mask & (1 << k))
+				sum.add(px[size_t(int(y) + NEIGHBOURS[k][1]) * w + int(x) + NEIGHBOURS[k][0]]);
+		const Pixel v = sum.average();
+		if(v == px[i])
+			continue;
+		px[i] = v;
+
+		for(unsigned k = 0; k < 8; ++k)
+		{
+			const unsigned xn = int(x) + NEIGHBOURS[k][0];
+			const unsigned yn = int(y) + NEIGHBOURS[k][1];
+			if(xn >= w || yn >= h)
+				continue;
+			const unsigned t = step[size_t(yn) * w + xn];
+			if(t > s + 1 && (plan.neighbours[t - 1] & (1 << (7 - k))) && !queued[t - 1])
+			{
+				queued[t - 1] = true;
+				todo.push(t - 1);
+			}
+		}
+	}
+	return true;
+}
+
+static void analyze(const Image& img, FastAnalysis& fa)
+{
+	fa.begin(img.width(), img.height());
+	for(unsigned y = 0; y < img.height(); ++y)
+		fa.row(img, y);
 }
 
+void pngrimAccurate(Image& img, PlanCache *cache)
+{
+	FillPlan *plan = 0;
+	unsigned long long hash = 0;
+	if(cache && planFits(img))
+	{
+		FastAnalysis pre;
+		analyze(img, pre);
+		if(const FillPlan *cached = cache->acquire(pre, true))
+		{
+			applyFillPlan(img, *cached);
+			cache->release(cached);
+			return;
+		}
+		plan = new FillPlan;
+		hash = pre.maskHash;
+	}
+	switch(img.format())
+	{
+		case PIXEL_RGBA8: rimAccurate<RGBA8Traits>(img, plan); break;
+		case PIXEL_GA8: rimAccurate<GA8Traits>(img, plan); break;
+		case PIXEL_RGBA16: rimAccurate<RGBA16Traits>(img, plan); break;
+		case PIXEL_GA16: rimAccurate<GA16Traits>(img, plan); break;
+	}
+	if(plan)
+		cache->release(cache->insert(hash, plan));
+}
+
+void pngrimFast(Image& img, FastAnalysis *pre, PlanCache *cache)
+{
+	FastAnalysis local;
+	if(!pre)
+	{
+		analyze(img, local);
+		pre = &local;
+	}
+
+	FillPlan *plan = 0;
+	if(cache && planFits(img))
+	{
+		if(const FillPlan *cached = cache->acquire(*pre, false))
+		{
+			applyFillPlan(img, *cached);
+			cache->release(cached);
+			return;
+		}
+		plan = new FillPlan;
+	}
+	switch(img.format())
+	{
+		case PIXEL_RGBA8: rimFast<RGBA8Traits>(img, pre, plan); break;
+		case PIXEL_GA8: rimFast<GA8Traits>(img, pre, plan); break;
+		case PIXEL_RGBA16: rimFast<RGBA16Traits>(img, pre, plan); break;
+		case PIXEL_GA16: rimFast<GA16Traits>(img, pre, plan); break;
+	}
+	if(plan)
+		cache->release(cache->insert(pre->maskHash, plan));
+}
+
+bool pngrimUpdate(Image& img, const Image& prev, bool accurate, FastAnalysis *pre, PlanCache& cache)
+{
+	FastAnalysis local;
+	if(!pre)
+	{
+		analyze(img, local);
+		pre = &local;
+	}
+
+	const FillPlan *plan = planFits(img) ? cache.acquire(*pre, accurate) : 0;
+	if(plan)
+	{
+		bool ok = false;
+		switch(img.format())
+		{
+			case PIXEL_RGBA8: ok = updateFill<RGBA8Traits>(img, prev, *plan); break;
+			case PIXEL_GA8: ok = updateFill<GA8Traits>(img, prev, *plan); break;
+			case PIXEL_RGBA16: ok = updateFill<RGBA16Traits>(img, prev, *plan); break;
+			case PIXEL_GA16: ok = updateFill<GA16Traits>(img, prev, *plan); break;
+		}
+		cache.release(plan);
+		if(ok)
+			return true;
+	}
+
+	if(accurate)
+		pngrimAccurate(img, &cache);
+	else
+		pngrimFast(img, pre, &cache);
+	return false;
+}
@@ -1,7 +1,92 @@
 #ifndef PNGRIM_FUNCS_H
 #define PNGRIM_FUNCS_H
 
-void pngrimAccurate(Image& img);
-void pngrimFast(Image& img);
+#include <vector>
+#include "ImagePNG.h"
+#include "Matrix.h"
+
+class PlanCache;
+
+// A run of transparent pixels [begin, end) in a row
+struct Span
+{
+	Span() {}
+	Span(unsigned b, unsigned e) : begin(b), end(e) {}
+	unsigned begin, end;
+};
+
+// First phase of pngrimFast(): alpha classification and the distance
+// transform in X direction. Both only look at one row at a time, so this
+// can run on rows as they come out of the decoder.
+// Rows are classified into runs of transparent pixels; the X distances of
+// a run follow from its ends, the later phases skip the pixels between.
+class FastAnalysis
+{
+public:
+	FastAnalysis() : numtrans(0), maskHash(0) {}
+
+	void begin(unsigned w, unsigned h);
+	void row(const Image& img, unsigned y);
+
+	const Span *spansBegin(unsigned y) const { return spans.empty() ? 0 : &spans[0] + rowSpans[y]; }
+	const Span *spansEnd(unsigned y) const { return spans.empty() ? 0 : &spans[0] + rowSpans[y + 1]; }
+
+	Matrix<unsigned> dist;
+	std::vector<Span> spans;       // row by row
+	std::vector<size_t> rowSpans;  // spans of row y start at rowSpans[y]
+	size_t numtrans;
+	unsigned long long maskHash; // of which pixels are transparent, for PlanCache
+};
+
+// What pngrimFast() or pngrimAccurate() does to an image, minus the
+// colors: the transparent pixels (y * width + x) in the order they are
+// filled, and for each the neighbours it gets the average color of (bit i
+// set = NEIGHBOURS[i]).
+// Only depends on which pixels are transparent, so images that differ in
+// color only (recolored sprites, animation frames) can share one plan.
+// Pixels are indexed with 32 bits, images past planFits() get no plans.
+struct FillPlan
+{
+	FillPlan() : width(0), height(0), numtrans(0), accurate(false) {}
+
+	size_t bytes() const { return pixels.size() * (sizeof(unsigned) + 1); }
+
+	unsigned width, height;
+	size_t numtrans;   // pixels.size(), or all pixels with nothing to fill
+	bool accurate;     // made by pngrimAccurate(), not pngrimFast()
+	std::vector<unsigned> pixels;
+	std::vector<unsigned char> neighbours;
+};
+
+// Neighbour offsets (x, y) for FillPlan::neighbours, bit 0 first
+extern const int NEIGHBOURS[8][2];
+
+inline bool planFits(const Image& img) { return img.numPixels() <= 0xffffffffu; }
+
+// True if plan was made for exactly the transparent pixels pre has seen.
+bool planMatches(const FillPlan& plan, const FastAnalysis& pre);
+// Fills the transparent pixels of img as planned.
+void applyFillPlan(Image& img, const FillPlan& plan);
+
+// With a cache (and planFits()), a plan of the engine for the same transparent pixels is
+// applied if there is one; otherwise the fill is recorded and added as a
+// new plan.
+void pngrimAccurate(Image& img, PlanCache *cache = 0);
+// If 'pre' is given, it must have seen all rows of img.
+void pngrimFast(Image& img, FastAnalysis *pre = 0, PlanCache *cache = 0);
+
+// Normalized convolution: premultiplied colors and alpha weights smoothed
+// by recursive Gaussians of growing size, the color of a transparent pixel
+// taken from the finest ones that reach enough opaque pixels. The bleed is
+// smoother than with the other engines, and each scale costs the same per
+// pixel however large the empty areas are. No plans.
+void pngrimSmooth(Image& img);
+
+// pngrimAccurate() or pngrimFast() for img, an edited version of an image
+// that the same engine turned into prev. If the transparent pixels are
+// still the same and their plan is in the cache, only the filled pixels
+// that depend on changed colors are recomputed, the others are copied from
+// prev. Otherwise the whole image is done. True if it was incremental.
+bool pngrimUpdate(Image& img, const Image& prev, bool accurate, FastAnalysis *pre, PlanCache& cache);
 
 #endif
@@ -6,6 +6,8 @@
 /* @(#) $Id$ */
 
 #include "zutil.h"
+#include "cpu_features.h"
+#include "adler32_simd.h"
 
 #define local static
 
@@ -84,6 +86,20 @@ uLong ZEXPORT adler32(adler, buf, len)
     if (buf == Z_NULL)
         return 1L;
 
+#ifdef X86_SIMD
+    /* hand longer inputs to adler32_simd.c if the CPU allows */
+    if (len >= ADLER32_SIMD_MIN) {
+        int features = x86_cpu_features();
+
+#ifdef X86_AVX2_SIMD
+        if (features & X86_AVX2)
+            return adler32_avx2(adler | (sum2 << 16), buf, len);
+#endif
+        if (features & X86_SSSE3)
+            return adler32_ssse3(adler | (sum2 << 16), buf, len);
+    }
+#endif /* X86_SIMD */
+
     /* in case short lengths are provided, keep it somewhat fast */
     if (len < 16) {
         while (len--) {
@@ -0,0 +1,167 @@
+/* adler32_simd.c -- compute the Adler-32 checksum using SSSE3 or AVX2
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * For a block of n bytes b[0..n-1] the sums advance as
+ *
+ *   sum1' = sum1 + (b[0] + ... + b[n-1])
+ *   sum2' = sum2 + n * sum1 + (n * b[0] + (n-1) * b[1] + ... + 1 * b[n-1])
+ *
+ * The plain byte sum is psadbw against zero, the weighted one pmaddubsw
+ * with the weights n..1 followed by pmaddwd with ones.  n * sum1 is kept as
+ * a running sum of the block-start values of sum1 and scaled at the end.
+ * As in adler32.c, at most NMAX bytes go by between reductions mod BASE.
+ */
+
+/* @(#) $Id$ */
+
+#include "zutil.h"
+#include "cpu_features.h"
+#include "adler32_simd.h"
+
+#ifdef X86_SIMD
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#ifdef X86_AVX2_SIMD
+#  include <immintrin.h>
+#endif
+
+#define BASE 65521UL    /* largest prime smaller than 65536 */
+#define NMAX 5552       /* see adler32.c */
+
+/* ========================================================================= */
+local uLong adler32_tail OF((unsigned long sum1, unsigned long sum2,
+                             const Bytef *buf, uInt len));
+
+/* finish the last len < 64 bytes, sum1 and sum2 are already reduced */
+local uLong adler32_tail(sum1, sum2, buf, len)
+    unsigned long sum1;
+    unsigned long sum2;
+    const Bytef *buf;
+    uInt len;
+{
+    while (len--) {
+        sum1 += *buf++;
+        sum2 += sum1;
+    }
+    sum1 %= BASE;
+    sum2 %= BASE;
+    return sum1 | (sum2 << 16);
+}
+
+/* ========================================================================= */
+uLong X86_TARGET("ssse3") ZLIB_INTERNAL adler32_ssse3(adler, buf, len)
+    uLong adler;
+    const Bytef *buf;
+    uInt len;
+{
+    const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                       24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9,
+                                       8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    unsigned long sum1 = adler & 0xffff;
+    unsigned long sum2 = (adler >> 16) & 0xffff;
+    unsigned blocks = len / 32;
+
+    len -= blocks * 32;
+    while (blocks) {
+        unsigned n = blocks < NMAX / 32 ? blocks : NMAX / 32;
+        __m128i v_ps = _mm_cvtsi32_si128((int)(sum1 * n));
+        __m128i v_s1 = zero;
+        __m128i v_s2 = _mm_cvtsi32_si128((int)sum2);
+
+        blocks -= n;
+        do {
+            const __m128i b1 = _mm_loadu_si128((const __m128i *)buf);
+            const __m128i b2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(b1, zero));
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(b2, zero));
+            v_s2 = _mm_add_epi32(v_s2,
+                       _mm_madd_epi16(_mm_maddubs_epi16(b1, tap1), ones));
+            v_s2 = _mm_add_epi32(v_s2,
+                       _mm_madd_epi16(_mm_maddubs_epi16(b2, tap2), ones));
+            buf += 32;
+        } while (--n);
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+        /* horizontal sums */
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, 0xb1));
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, 0x4e));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, 0xb1));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, 0x4e));
+        sum1 = (sum1 + (unsigned)_mm_cvtsi128_si32(v_s1)) % BASE;
+        sum2 = (unsigned)_mm_cvtsi128_si32(v_s2) % BASE;
+    }
+
+    return adler32_tail(sum1, sum2, buf, len);
+}
+
+#ifdef X86_AVX2_SIMD
+/* ========================================================================= */
+uLong X86_TARGET("avx2") ZLIB_INTERNAL adler32_avx2(adler, buf, len)
+    uLong adler;
+    const Bytef *buf;
+    uInt len;
+{
+    /* 64 byte blocks, two loads per step to shorten the dependency chain */
+    const __m256i tap1 = _mm256_setr_epi8(64, 63, 62, 61, 60, 59, 58, 57,
+                                          56, 55, 54, 53, 52, 51, 50, 49,
+                                          48, 47, 46, 45, 44, 43, 42, 41,
+                                          40, 39, 38, 37, 36, 35, 34, 33);
+    const __m256i tap2 = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                          24, 23, 22, 21, 20, 19, 18, 17,
+                                          16, 15, 14, 13, 12, 11, 10, 9,
+                                          8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    unsigned long sum1 = adler & 0xffff;
+    unsigned long sum2 = (adler >> 16) & 0xffff;
+    unsigned blocks = len / 64;
+
+    len -= blocks * 64;
+    while (blocks) {
+        unsigned n = blocks < NMAX / 64 ? blocks : NMAX / 64;
+        __m256i v_ps = _mm256_setr_epi32((int)(sum1 * n), 0, 0, 0,
+                                         0, 0, 0, 0);
+        __m256i v_s1 = zero;
+        __m256i v_s2 = _mm256_setr_epi32((int)sum2, 0, 0, 0, 0, 0, 0, 0);
+        __m128i s1, s2;
+
+        blocks -= n;
+        do {
+            const __m256i b1 = _mm256_loadu_si256((const __m256i *)buf);
+            const __m256i b2 = _mm256_loadu_si256((const __m256i *)(buf + 32));
+
+            v_ps = _mm256_add_epi32(v_ps, v_s1);
+            v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(b1, zero));
+            v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(b2, zero));
+            v_s2 = _mm256_add_epi32(v_s2,
+                       _mm256_madd_epi16(_mm256_maddubs_epi16(b1, tap1), ones));
+            v_s2 = _mm256_add_epi32(v_s2,
+                       _mm256_madd_epi16(_mm256_maddubs_epi16(b2, tap2), ones));
+            buf += 64;
+        } while (--n);
+        v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 6));
+
+        /* horizontal sums */
+        s1 = _mm_add_epi32(_mm256_castsi256_si128(v_s1),
+                           _mm256_extracti128_si256(v_s1, 1));
+        s2 = _mm_add_epi32(_mm256_castsi256_si128(v_s2),
+                           _mm256_extracti128_si256(v_s2, 1));
+        s1 = _mm_add_epi32(s1, _mm_shuffle_epi32(s1, 0xb1));
+        s1 = _mm_add_epi32(s1, _mm_shuffle_epi32(s1, 0x4e));
+        s2 = _mm_add_epi32(s2, _mm_shuffle_epi32(s2, 0xb1));
+        s2 = _mm_add_epi32(s2, _mm_shuffle_epi32(s2, 0x4e));
+        sum1 = (sum1 + (unsigned)_mm_cvtsi128_si32(s1)) % BASE;
+        sum2 = (unsigned)_mm_cvtsi128_si32(s2) % BASE;
+    }
+
+    return adler32_tail(sum1, sum2, buf, len);
+}
+#endif /* X86_AVX2_SIMD */
+
+#endif /* X86_SIMD */
@@ -0,0 +1,24 @@
+/* adler32_simd.h -- SIMD versions of adler32()
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/* WARNING: this file should *not* be used by applications. It is
+   part of the implementation of the compression library and is
+   subject to change. Applications should only use zlib.h.
+ */
+
+#ifdef X86_SIMD
+
+/* Shorter inputs stay with the scalar code */
+#define ADLER32_SIMD_MIN 64
+
+/* Take and return the checksum in the same form as adler32(); buf must not
+   be Z_NULL.  Use only on CPUs with X86_SSSE3 or X86_AVX2, respectively. */
+uLong ZLIB_INTERNAL adler32_ssse3 OF((uLong adler, const Bytef *buf,
+                                      uInt len));
+#ifdef X86_AVX2_SIMD
+uLong ZLIB_INTERNAL adler32_avx2 OF((uLong adler, const Bytef *buf,
+                                     uInt len));
+#endif
+
+#endif /* X86_SIMD */
@@ -0,0 +1,84 @@
+/* cpu_features.c -- runtime detection of x86 SIMD instruction sets
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/* @(#) $Id$ */
+
+#include "zutil.h"
+#include "cpu_features.h"
+
+#ifdef X86_SIMD
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#else
+#  include <cpuid.h>
+#endif
+
+local void cpuid OF((unsigned leaf, unsigned regs[4]));
+#ifdef X86_AVX2_SIMD
+local unsigned xgetbv0 OF((void));
+#endif
+
+/* leaf with subleaf 0 */
+local void cpuid(leaf, regs)
+    unsigned leaf;
+    unsigned regs[4];
+{
+#ifdef _MSC_VER
+    int r[4];
+
+    __cpuidex(r, (int)leaf, 0);
+    regs[0] = r[0]; regs[1] = r[1]; regs[2] = r[2]; regs[3] = r[3];
+#else
+    if (leaf > __get_cpuid_max(0, 0))
+        regs[0] = regs[1] = regs[2] = regs[3] = 0;
+    else
+        __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+#ifdef X86_AVX2_SIMD
+/* low half of XCR0, the register state the OS saves on context switches */
+local unsigned xgetbv0()
+{
+#ifdef _MSC_VER
+    return (unsigned)_xgetbv(0);
+#else
+    unsigned eax, edx;
+
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return eax;
+#endif
+}
+#endif
+
+int ZLIB_INTERNAL x86_cpu_features()
+{
+    static volatile int features = -1;
+    unsigned regs[4];
+    int f;
+
+    if (features >= 0)
+        return features;
+
+    f = 0;
+    cpuid(1, regs);
+    if (regs[2] & (1 << 1))
+        f |= X86_PCLMUL;
+    if (regs[2] & (1 << 9))
+        f |= X86_SSSE3;
+#ifdef X86_AVX2_SIMD
+    /* AVX2 needs OSXSAVE and the OS saving both XMM and YMM state */
+    if ((regs[2] & (1 << 27)) && (xgetbv0() & 6) == 6) {
+        cpuid(7, regs);
+        if (regs[1] & (1 << 5))
+            f |= X86_AVX2;
+    }
+#endif
+
+    features = f;
+    return f;
+}
+
+#endif /* X86_SIMD */
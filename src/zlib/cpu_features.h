@@ -0,0 +1,47 @@
+/* cpu_features.h -- runtime detection of x86 SIMD instruction sets
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/* WARNING: this file should *not* be used by applications. It is
+   part of the implementation of the compression library and is
+   subject to change. Applications should only use zlib.h.
+ */
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+/* The SIMD code is only built for x86 with a compiler that can target the
+   newer instruction sets per function.  Define NO_X86_SIMD to leave it out.
+   X86_AVX2_SIMD is set when the compiler also knows the AVX2 intrinsics.
+ */
+#ifndef NO_X86_SIMD
+#  if (defined(__i386__) || defined(__x86_64__)) && defined(__GNUC__) && \
+      (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || \
+       defined(__clang__))
+#    define X86_SIMD
+#    define X86_AVX2_SIMD
+#    define X86_TARGET(isa) __attribute__((target(isa)))
+#  elif (defined(_M_IX86) || defined(_M_X64)) && defined(_MSC_VER) && \
+        _MSC_VER >= 1500
+#    define X86_SIMD
+#    if _MSC_VER >= 1700
+#      define X86_AVX2_SIMD
+#    endif
+#    define X86_TARGET(isa)
+#  endif
+#endif
+
+#ifdef X86_SIMD
+
+#define X86_PCLMUL 1    /* PCLMULQDQ */
+#define X86_SSSE3  2
+#define X86_AVX2   4    /* only reported if X86_AVX2_SIMD and the OS saves
+                           the YMM registers */
+
+/* Bit set of the X86_* features above that this CPU and OS support.
+   Detected on first use; racing first calls compute the same value. */
+int ZLIB_INTERNAL x86_cpu_features OF((void));
+
+#endif /* X86_SIMD */
+
+#endif /* CPU_FEATURES_H */
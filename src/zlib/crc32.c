@@ -7,6 +7,9 @@
  * tables for updating the shift register in one step with three exclusive-ors
  * instead of four steps with four exclusive-ors.  This results in about a
  * factor of two increase in speed on a Power PC G4 (PPC7455) using gcc -O3.
+ *
+ * Little-endian machines go on to sixteen bytes at a time with twelve more
+ * tables, and x86 CPUs with PCLMULQDQ use crc32_pclmul() in crc32_simd.c.
  */
 
 /* @(#) $Id$ */
@@ -27,6 +30,8 @@
 #endif /* MAKECRCH */
 
 #include "zutil.h"      /* for STDC and FAR definitions */
+#include "cpu_features.h"
+#include "crc32_simd.h"
 
 #define local static
 
@@ -59,7 +64,7 @@
                         const unsigned char FAR *, unsigned));
    local unsigned long crc32_big OF((unsigned long,
                         const unsigned char FAR *, unsigned));
-#  define TBLS 8
+#  define TBLS 20       /* little 0-3, big 0-3, little 4-15 */
 #else
 #  define TBLS 1
 #endif /* BYFOUR */
@@ -103,7 +108,8 @@ local void make_crc_table OF((void));
   all the information needed to generate CRCs on data a byte at a time for all
   combinations of CRC register values and incoming bytes.  The remaining tables
   allow for word-at-a-time CRC calculation for both big-endian and little-
-  endian machines, where a word is four bytes.
+  endian machines, where a word is four bytes, and for four words at a time
+  on little-endian machines.
 */
 local void make_crc_table()
 {
@@ -144,6 +150,10 @@ local void make_crc_table()
                 crc_table[k][n] = c;
                 crc_table[k + 4][n] = REV(c);
             }
+            for (k = 8; k < 20; k++) {
+                c = crc_table[0][c & 0xff] ^ (c >> 8);
+                crc_table[k][n] = c;
+            }
         }
 #endif /* BYFOUR */
 
@@ -169,7 +179,7 @@ local void make_crc_table()
         write_table(out, crc_table[0]);
 #  ifdef BYFOUR
         fprintf(out, "#ifdef BYFOUR\n");
-        for (k = 1; k < 8; k++) {
+        for (k = 1; k < TBLS; k++) {
             fprintf(out, "  },\n  {\n");
             write_table(out, crc_table[k]);
         }
@@ -225,6 +235,17 @@ unsigned long ZEXPORT crc32(crc, buf, len)
 {
     if (buf == Z_NULL) return 0UL;
 
+#ifdef X86_SIMD
+    if (len >= CRC32_PCLMUL_MIN && (x86_cpu_features() & X86_PCLMUL)) {
+        unsigned blocks = len & ~15U;
+
+        crc = crc32_pclmul(crc, buf, blocks);
+        buf += blocks;
+        len -= blocks;
+        if (len == 0) return crc;
+    }
+#endif /* X86_SIMD */
+
 #ifdef DYNAMIC_CRC_TABLE
     if (crc_table_empty)
         make_crc_table();
@@ -258,7 +279,16 @@ unsigned long ZEXPORT crc32(crc, buf, len)
 #define DOLIT4 c ^= *buf4++; \
         c = crc_table[3][c & 0xff] ^ crc_table[2][(c >> 8) & 0xff] ^ \
             crc_table[1][(c >> 16) & 0xff] ^ crc_table[0][c >> 24]
-#define DOLIT32 DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4
+#define DOLIT16 c ^= *buf4++; w1 = *buf4++; w2 = *buf4++; w3 = *buf4++; \
+        c = crc_table[19][c & 0xff] ^ crc_table[18][(c >> 8) & 0xff] ^ \
+            crc_table[17][(c >> 16) & 0xff] ^ crc_table[16][c >> 24] ^ \
+            crc_table[15][w1 & 0xff] ^ crc_table[14][(w1 >> 8) & 0xff] ^ \
+            crc_table[13][(w1 >> 16) & 0xff] ^ crc_table[12][w1 >> 24] ^ \
+            crc_table[11][w2 & 0xff] ^ crc_table[10][(w2 >> 8) & 0xff] ^ \
+            crc_table[9][(w2 >> 16) & 0xff] ^ crc_table[8][w2 >> 24] ^ \
+            crc_table[3][w3 & 0xff] ^ crc_table[2][(w3 >> 8) & 0xff] ^ \
+            crc_table[1][(w3 >> 16) & 0xff] ^ crc_table[0][w3 >> 24]
+#define DOLIT64 DOLIT16; DOLIT16; DOLIT16; DOLIT16
 
 /* ========================================================================= */
 local unsigned long crc32_little(crc, buf, len)
@@ -266,7 +296,7 @@ local unsigned long crc32_little(crc, buf, len)
     const unsigned char FAR *buf;
     unsigned len;
 {
-    register u4 c;
+    register u4 c, w1, w2, w3;
     register const u4 FAR *buf4;
 
     c = (u4)crc;
@@ -277,9 +307,13 @@ local unsigned long crc32_little(crc, buf, len)
     }
 
     buf4 = (const u4 FAR *)(const void FAR *)buf;
-    while (len >= 32) {
-        DOLIT32;
-        len -= 32;
+    while (len >= 64) {
+        DOLIT64;
+        len -= 64;
+    }
+    while (len >= 16) {
+        DOLIT16;
+        len -= 16;
     }
     while (len >= 4) {
         DOLIT4;
@@ -0,0 +1,111 @@
+/* crc32_simd.c -- compute the CRC-32 of a data stream using PCLMULQDQ
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * Folds 64 bytes at a time with carry-less multiplication and reduces the
+ * result with Barrett reduction, following Gopal et al., "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction", Intel,
+ * 2009.  The constants are the bit-reflected ones for the CRC-32 polynomial
+ * from the end of that paper.
+ */
+
+/* @(#) $Id$ */
+
+#include "zutil.h"
+#include "cpu_features.h"
+#include "crc32_simd.h"
+
+#ifdef X86_SIMD
+
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+#define CLMUL(a, b, imm) _mm_clmulepi64_si128(a, b, imm)
+
+/* ========================================================================= */
+unsigned long X86_TARGET("sse2,pclmul") ZLIB_INTERNAL crc32_pclmul(crc, buf,
+                                                                   len)
+    unsigned long crc;
+    const unsigned char FAR *buf;
+    unsigned len;
+{
+    /* x^(4*128+64), x^(4*128) mod P, folds 64 bytes at a time */
+    const __m128i k1k2 = _mm_setr_epi32(0x54442bd4, 1, 0xc6e41596, 1);
+    /* x^(128+64), x^128 mod P, folds 16 bytes at a time */
+    const __m128i k3k4 = _mm_setr_epi32(0x751997d0, 1, 0xccaa009e, 0);
+    /* x^64 mod P, folds 128 bits down to 64 */
+    const __m128i k5 = _mm_setr_epi32(0x63cd6124, 1, 0, 0);
+    /* P and mu = floor(x^64 / P) for the Barrett reduction */
+    const __m128i poly = _mm_setr_epi32(0xdb710641, 1, 0xf7011641, 1);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)~(unsigned)crc));
+    buf += 64;
+    len -= 64;
+
+    /* fold four 128-bit lanes in parallel */
+    while (len >= 64) {
+        x5 = CLMUL(x1, k1k2, 0x00);
+        x6 = CLMUL(x2, k1k2, 0x00);
+        x7 = CLMUL(x3, k1k2, 0x00);
+        x8 = CLMUL(x4, k1k2, 0x00);
+        x1 = CLMUL(x1, k1k2, 0x11);
+        x2 = CLMUL(x2, k1k2, 0x11);
+        x3 = CLMUL(x3, k1k2, 0x11);
+        x4 = CLMUL(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                 _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                 _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                 _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                 _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+        buf += 64;
+        len -= 64;
+    }
+
+    /* fold the four lanes into one */
+    x5 = CLMUL(x1, k3k4, 0x00);
+    x1 = CLMUL(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = CLMUL(x1, k3k4, 0x00);
+    x1 = CLMUL(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = CLMUL(x1, k3k4, 0x00);
+    x1 = CLMUL(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* then any remaining 16 byte blocks */
+    while (len >= 16) {
+        x5 = CLMUL(x1, k3k4, 0x00);
+        x1 = CLMUL(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1,
+                 _mm_loadu_si128((const __m128i *)buf)), x5);
+        buf += 16;
+        len -= 16;
+    }
+
+    /* 128 bits down to 64 */
+    x2 = CLMUL(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_xor_si128(CLMUL(x1, k5, 0x00), x2);
+
+    /* Barrett reduction to 32 bits */
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = CLMUL(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = CLMUL(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_srli_si128(x1, 4);
+    return (unsigned long)(~(unsigned)_mm_cvtsi128_si32(x0) & 0xffffffffUL);
+}
+
+#endif /* X86_SIMD */
@@ -0,0 +1,20 @@
+/* crc32_simd.h -- SIMD versions of crc32()
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/* WARNING: this file should *not* be used by applications. It is
+   part of the implementation of the compression library and is
+   subject to change. Applications should only use zlib.h.
+ */
+
+#ifdef X86_SIMD
+
+/* Shortest input worth the setup of crc32_pclmul() */
+#define CRC32_PCLMUL_MIN 64
+
+/* crc of a multiple of 16 bytes, len >= CRC32_PCLMUL_MIN, on CPUs with
+   X86_PCLMUL.  Takes and returns the crc in the same form as crc32(). */
+unsigned long ZLIB_INTERNAL crc32_pclmul OF((unsigned long crc,
+                        const unsigned char FAR *buf, unsigned len));
+
+#endif /* X86_SIMD */
@@ -91,6 +91,10 @@ local int read_buf        OF((z_streamp strm, Bytef *buf, unsigned size));
 #else
 local uInt longest_match  OF((deflate_state *s, IPos cur_match));
 #endif
+#if !defined(ASMV) || defined(FASTEST)
+local uInt compare258     OF((const Bytef *scan, const Bytef *match));
+#endif
+local void slide_hash     OF((deflate_state *s));
 
 #ifdef DEBUG
 local  void check_match OF((deflate_state *s, IPos start, IPos match,
@@ -155,6 +159,32 @@ local const config configuration_table[10] = {
 struct static_tree_desc_s {int dummy;}; /* for buggy compilers */
 #endif
 
+/* ===========================================================================
+ * Match finder options, selected at build time:
+ *   DEFLATE_HASH4         hash the first four bytes of each string instead
+ *                         of MIN_MATCH with the rolling hash. The hash chains
+ *                         get much shorter, which makes levels 6-9 faster,
+ *                         but most three-byte matches are no longer found.
+ *                         On PNG image data (three-byte RGB pixels) that
+ *                         costs about 6% in size, so it is off by default.
+ *                         The hash is computed from the bytes, not from a
+ *                         machine word, so the output does not depend on the
+ *                         CPU or its byte order.
+ *   DEFLATE_BYTE_COMPARE  compare match candidates one byte at a time instead
+ *                         of 16 (SSE2) or 8 bytes at once.
+ * Neither the compare nor the window slide changes the compressed output.
+ */
+#if !defined(NO_X86_SIMD) && (defined(__SSE2__) || defined(_M_X64) || \
+                              (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#  define DEFLATE_SSE2          /* always there, no run time check needed */
+#  include <emmintrin.h>
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#  endif
+#endif
+
+#ifndef DEFLATE_HASH4
+
 /* ===========================================================================
  * Update a hash value with the given input byte
  * IN  assertion: all calls to to UPDATE_HASH are made with consecutive
@@ -163,6 +193,40 @@ struct static_tree_desc_s {int dummy;}; /* for buggy compilers */
  */
 #define UPDATE_HASH(s,h,c) (h = (((h)<<s->hash_shift) ^ (c)) & s->hash_mask)
 
+/* ===========================================================================
+ * Set ins_h to the hash index of the string at str. The rolling hash only
+ * adds str[MIN_MATCH-1] to the running key, which HASH_INIT starts from the
+ * first bytes of the string.
+ */
+#define HASH_STRING(s, str) \
+    UPDATE_HASH(s, s->ins_h, s->window[(str) + (MIN_MATCH-1)])
+#define HASH_BYTES MIN_MATCH
+
+#define HASH_INIT(s, str) \
+   (s->ins_h = s->window[str], \
+    UPDATE_HASH(s, s->ins_h, s->window[(str)+1]))
+#if MIN_MATCH != 3
+            Call UPDATE_HASH() MIN_MATCH-3 more times in HASH_INIT
+#endif
+
+#else /* !DEFLATE_HASH4 */
+
+/* Multiplicative (Fibonacci) hash of the four bytes at str. Reading
+ * str[3] when only MIN_MATCH bytes remain is fine, fill_window() keeps the
+ * bytes after the data initialized.
+ */
+#define HASH_STRING(s, str) \
+   (s->ins_h = (uInt)(((((ulg)s->window[str] | \
+                         ((ulg)s->window[(str)+1] << 8) | \
+                         ((ulg)s->window[(str)+2] << 16) | \
+                         ((ulg)s->window[(str)+3] << 24)) * 2654435761UL) & \
+                        0xffffffffUL) >> (32 - s->hash_bits)))
+#define HASH_BYTES 4
+
+/* No running state to set up */
+#define HASH_INIT(s, str) (void)0
+
+#endif /* !DEFLATE_HASH4 */
 
 /* ===========================================================================
  * Insert string str in the dictionary and set match_head to the previous head
@@ -176,12 +240,12 @@ struct static_tree_desc_s {int dummy;}; /* for buggy compilers */
  */
 #ifdef FASTEST
 #define INSERT_STRING(s, str, match_head) \
-   (UPDATE_HASH(s, s->ins_h, s->window[(str) + (MIN_MATCH-1)]), \
+   (HASH_STRING(s, str), \
     match_head = s->head[s->ins_h], \
     s->head[s->ins_h] = (Pos)(str))
 #else
 #define INSERT_STRING(s, str, match_head) \
-   (UPDATE_HASH(s, s->ins_h, s->window[(str) + (MIN_MATCH-1)]), \
+   (HASH_STRING(s, str), \
     match_head = s->prev[(str) & s->w_mask] = s->head[s->ins_h], \
     s->head[s->ins_h] = (Pos)(str))
 #endif
@@ -303,6 +367,7 @@ int ZEXPORT deflateInit2_(strm, level, method, windowBits, memLevel, strategy,
     s->level = level;
     s->strategy = strategy;
     s->method = (Byte)method;
+    s->stride[0] = s->stride[1] = 0;
 
     return deflateReset(strm);
 }
@@ -336,13 +401,13 @@ int ZEXPORT deflateSetDictionary (strm, dictionary, dictLength)
     s->strstart = length;
     s->block_start = (long)length;
 
-    /* Insert all strings in the hash table (except for the last two bytes).
+    /* Insert all strings in the hash table (except for the last HASH_BYTES-1
+     * bytes, whose hash would depend on the bytes after the dictionary).
      * s->lookahead stays null, so s->ins_h will be recomputed at the next
      * call of fill_window.
      */
-    s->ins_h = s->window[0];
-    UPDATE_HASH(s, s->ins_h, s->window[1]);
-    for (n = 0; n <= length - MIN_MATCH; n++) {
+    HASH_INIT(s, 0);
+    for (n = 0; n + HASH_BYTES <= length; n++) {
         INSERT_STRING(s, n, hash_head);
     }
     if (hash_head) hash_head = 0;  /* to make compiler happy */
@@ -466,6 +531,30 @@ int ZEXPORT deflateTune(strm, good_length, max_lazy, nice_length, max_chain)
     return Z_OK;
 }
 
+/* ========================================================================= */
+int ZEXPORT deflateStrides(strm, dist1, dist2)
+    z_streamp strm;
+    uInt dist1;
+    uInt dist2;
+{
+    deflate_state *s;
+
+    if (strm == Z_NULL || strm->state == Z_NULL) return Z_STREAM_ERROR;
+    s = strm->state;
+#if defined(FASTEST) || defined(ASMV)
+    return Z_STREAM_ERROR;      /* longest_match() has no strides */
+#else
+    if (dist1 == 0) {
+        dist1 = dist2;
+        dist2 = 0;
+    }
+    if (dist2 == dist1) dist2 = 0;
+    s->stride[0] = dist1;
+    s->stride[1] = dist2;
+    return Z_OK;
+#endif
+}
+
 /* =========================================================================
  * For the default windowBits of 15 and memLevel of 8, this function returns
  * a close to exact, as well as small, upper bound on the compressed size.
@@ -1046,6 +1135,70 @@ local void lm_init (s)
 #endif
 }
 
+#if !defined(ASMV) || defined(FASTEST)
+/* ===========================================================================
+ * Return the number of leading bytes (at most MAX_MATCH) that are equal in
+ * scan and match. Both may be read up to MAX_MATCH bytes ahead, which the
+ * window guarantees for strstart <= window_size-MIN_LOOKAHEAD.
+ */
+local uInt compare258(scan, match)
+    const Bytef *scan;
+    const Bytef *match;
+{
+    uInt len = 0;
+
+    Assert(MAX_MATCH == 258, "compare258 assumes MAX_MATCH == 258");
+#if defined(DEFLATE_SSE2) && !defined(DEFLATE_BYTE_COMPARE)
+    do {
+        int diff = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                       _mm_loadu_si128((const __m128i *)(scan + len)),
+                       _mm_loadu_si128((const __m128i *)(match + len))))
+                   ^ 0xffff;
+        if (diff) {
+#  ifdef _MSC_VER
+            unsigned long bit;
+            _BitScanForward(&bit, (unsigned long)diff);
+            return len + (uInt)bit;
+#  else
+            return len + (uInt)__builtin_ctz(diff);
+#  endif
+        }
+        len += 16;
+    } while (len < MAX_MATCH - 2);
+#elif !defined(DEFLATE_BYTE_COMPARE) && defined(__GNUC__) && \
+      defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && \
+      (defined(__LP64__) || defined(_LP64))
+    /* Compare a word at a time, the first difference is the lowest set bit
+     * of the exclusive or on a little-endian machine.
+     */
+    do {
+        unsigned long a, b;
+        zmemcpy(&a, scan + len, sizeof(a));
+        zmemcpy(&b, match + len, sizeof(b));
+        if (a != b)
+            return len + (uInt)(__builtin_ctzl(a ^ b) >> 3);
+        len += sizeof(a);
+    } while (len < MAX_MATCH - 2);
+#else
+    /* We check for insufficient lookahead only every 8th comparison */
+    do {
+        if (scan[len] != match[len]) return len;
+        if (scan[len+1] != match[len+1]) return len + 1;
+        if (scan[len+2] != match[len+2]) return len + 2;
+        if (scan[len+3] != match[len+3]) return len + 3;
+        if (scan[len+4] != match[len+4]) return len + 4;
+        if (scan[len+5] != match[len+5]) return len + 5;
+        if (scan[len+6] != match[len+6]) return len + 6;
+        if (scan[len+7] != match[len+7]) return len + 7;
+        len += 8;
+    } while (len < MAX_MATCH - 2);
+#endif
+    /* The last two bytes */
+    if (scan[len] != match[len]) return len;
+    return scan[len+1] != match[len+1] ? len + 1 : len + 2;
+}
+#endif
+
 #ifndef FASTEST
 /* ===========================================================================
  * Set match_start to the longest match starting at the given string and
@@ -1077,24 +1230,11 @@ local uInt longest_match(s, cur_match)
      */
     Posf *prev = s->prev;
     uInt wmask = s->w_mask;
-
-#ifdef UNALIGNED_OK
-    /* Compare two bytes at a time. Note: this is not always beneficial.
-     * Try with and without -DUNALIGNED_OK to check.
-     */
-    register Bytef *strend = s->window + s->strstart + MAX_MATCH - 1;
-    register ush scan_start = *(ushf*)scan;
-    register ush scan_end   = *(ushf*)(scan+best_len-1);
-#else
-    register Bytef *strend = s->window + s->strstart + MAX_MATCH;
     register Byte scan_end1  = scan[best_len-1];
     register Byte scan_end   = scan[best_len];
-#endif
+    int n;
 
-    /* The code is optimized for HASH_BITS >= 8 and MAX_MATCH-2 multiple of 16.
-     * It is easy to get rid of this optimization if necessary.
-     */
-    Assert(s->hash_bits >= 8 && MAX_MATCH == 258, "Code too clever");
+    Assert(MAX_MATCH == 258, "Code too clever");
 
     /* Do not waste too much time if we already have a good match: */
     if (s->prev_length >= s->good_match) {
@@ -1107,98 +1247,58 @@ local uInt longest_match(s, cur_match)
 
     Assert((ulg)s->strstart <= s->window_size-MIN_LOOKAHEAD, "need lookahead");
 
+    /* Try the distances given with deflateStrides() first. For image data
+     * these are often the best matches, but deep down the hash chain.
+     */
+    for (n = 0; n < 2 && s->stride[n]; n++) {
+        if (s->stride[n] >= s->strstart || s->stride[n] > MAX_DIST(s))
+            continue;
+        match = scan - s->stride[n];
+        if (match[best_len]   != scan_end  ||
+            match[best_len-1] != scan_end1 ||
+            *match            != *scan) continue;
+
+        len = (int)compare258(scan, match);
+        /* After deflateParams() best_len may start below MIN_MATCH-1 */
+        if (len > best_len && len >= MIN_MATCH) {
+            s->match_start = s->strstart - s->stride[n];
+            best_len = len;
+            if (len >= nice_match) goto done;
+            scan_end1  = scan[best_len-1];
+            scan_end   = scan[best_len];
+        }
+    }
+    /* With strides, the caller also comes here without a usable chain */
+    if (cur_match == NIL || s->strstart - cur_match > MAX_DIST(s))
+        goto done;
+
     do {
         Assert(cur_match < s->strstart, "no future");
         match = s->window + cur_match;
 
-        /* Skip to next match if the match length cannot increase
-         * or if the match length is less than 2.  Note that the checks below
-         * for insufficient lookahead only occur occasionally for performance
-         * reasons.  Therefore uninitialized memory will be accessed, and
-         * conditional jumps will be made that depend on those values.
-         * However the length of the match is limited to the lookahead, so
-         * the output of deflate is not affected by the uninitialized values.
+        /* Skip to next match if the match length cannot increase. The
+         * candidate is then compared in full: with the four-byte hash, equal
+         * hash keys do not imply equal leading bytes. Bytes past the
+         * lookahead may be compared, but the match length is limited to the
+         * lookahead below, so the output of deflate is not affected by them.
          */
-#if (defined(UNALIGNED_OK) && MAX_MATCH == 258)
-        /* This code assumes sizeof(unsigned short) == 2. Do not use
-         * UNALIGNED_OK if your compiler uses a different size.
-         */
-        if (*(ushf*)(match+best_len-1) != scan_end ||
-            *(ushf*)match != scan_start) continue;
-
-        /* It is not necessary to compare scan[2] and match[2] since they are
-         * always equal when the other bytes match, given that the hash keys
-         * are equal and that HASH_BITS >= 8. Compare 2 bytes at a time at
-         * strstart+3, +5, ... up to strstart+257. We check for insufficient
-         * lookahead only every 4th comparison; the 128th check will be made
-         * at strstart+257. If MAX_MATCH-2 is not a multiple of 8, it is
-         * necessary to put more guard bytes at the end of the window, or
-         * to check more often for insufficient lookahead.
-         */
-        Assert(scan[2] == match[2], "scan[2]?");
-        scan++, match++;
-        do {
-        } while (*(ushf*)(scan+=2) == *(ushf*)(match+=2) &&
-                 *(ushf*)(scan+=2) == *(ushf*)(match+=2) &&
-                 *(ushf*)(scan+=2) == *(ushf*)(match+=2) &&
-                 *(ushf*)(scan+=2) == *(ushf*)(match+=2) &&
-                 scan < strend);
-        /* The funny "do {}" generates better code on most compilers */
-
-        /* Here, scan <= window+strstart+257 */
-        Assert(scan <= s->window+(unsigned)(s->window_size-1), "wild scan");
-        if (*scan == *match) scan++;
-
-        len = (MAX_MATCH - 1) - (int)(strend-scan);
-        scan = strend - (MAX_MATCH-1);
-
-#else /* UNALIGNED_OK */
-
         if (match[best_len]   != scan_end  ||
             match[best_len-1] != scan_end1 ||
-            *match            != *scan     ||
-            *++match          != scan[1])      continue;
-
-        /* The check at best_len-1 can be removed because it will be made
-         * again later. (This heuristic is not always a win.)
-         * It is not necessary to compare scan[2] and match[2] since they
-         * are always equal when the other bytes match, given that
-         * the hash keys are equal and that HASH_BITS >= 8.
-         */
-        scan += 2, match++;
-        Assert(*scan == *match, "match[2]?");
-
-        /* We check for insufficient lookahead only every 8th comparison;
-         * the 256th check will be made at strstart+258.
-         */
-        do {
-        } while (*++scan == *++match && *++scan == *++match &&
-                 *++scan == *++match && *++scan == *++match &&
-                 *++scan == *++match && *++scan == *++match &&
-                 *++scan == *++match && *++scan == *++match &&
-                 scan < strend);
-
-        Assert(scan <= s->window+(unsigned)(s->window_size-1), "wild scan");
-
-        len = MAX_MATCH - (int)(strend - scan);
-        scan = strend - MAX_MATCH;
+            *match            != *scan) continue;
 
-#endif /* UNALIGNED_OK */
+        len = (int)compare258(scan, match);
 
         if (len > best_len) {
             s->match_start = cur_match;
             best_len = len;
             if (len >= nice_match) break;
-#ifdef UNALIGNED_OK
-            scan_end = *(ushf*)(scan+best_len-1);
-#else
             scan_end1  = scan[best_len-1];
             scan_end   = scan[best_len];
-#endif
         }
     } while ((cur_match = prev[cur_match & wmask]) > limit
              && --chain_length != 0);
 
+done:
     if ((uInt)best_len <= s->lookahead) return (uInt)best_len;
     return s->lookahead;
 }
@@ -1216,12 +1316,8 @@ local uInt longest_match(s, cur_match)
     register Bytef *scan = s->window + s->strstart; /* current string */
     register Bytef *match;                       /* matched string */
     register int len;                           /* length of current match */
-    register Bytef *strend = s->window + s->strstart + MAX_MATCH;
 
-    /* The code is optimized for HASH_BITS >= 8 and MAX_MATCH-2 multiple of 16.
-     * It is easy to get rid of this optimization if necessary.
-     */
-    Assert(s->hash_bits >= 8 && MAX_MATCH == 258, "Code too clever");
+    Assert(MAX_MATCH == 258, "Code too clever");
 
     Assert((ulg)s->strstart <= s->window_size-MIN_LOOKAHEAD, "need lookahead");
 
@@ -1229,32 +1325,12 @@ local uInt longest_match(s, cur_match)
 
     match = s->window + cur_match;
 
-    /* Return failure if the match length is less than 2:
+    /* Return failure if the match length is less than MIN_MATCH. All
+     * bytes are compared, the hash keys may be equal for different strings.
      */
     if (match[0] != scan[0] || match[1] != scan[1]) return MIN_MATCH-1;
 
-    /* The check at best_len-1 can be removed because it will be made
-     * again later. (This heuristic is not always a win.)
-     * It is not necessary to compare scan[2] and match[2] since they
-     * are always equal when the other bytes match, given that
-     * the hash keys are equal and that HASH_BITS >= 8.
-     */
-    scan += 2, match += 2;
-    Assert(*scan == *match, "match[2]?");
-
-    /* We check for insufficient lookahead only every 8th comparison;
-     * the 256th check will be made at strstart+258.
-     */
-    do {
-    } while (*++scan == *++match && *++scan == *++match &&
-             *++scan == *++match && *++scan == *++match &&
-             *++scan == *++match && *++scan == *++match &&
-             *++scan == *++match && *++scan == *++match &&
-             scan < strend);
-
-    Assert(scan <= s->window+(unsigned)(s->window_size-1), "wild scan");
-
-    len = MAX_MATCH - (int)(strend - scan);
+    len = (int)compare258(scan, match);
 
     if (len < MIN_MATCH) return MIN_MATCH - 1;
 
@@ -1292,6 +1368,50 @@ local void check_match(s, start, match, length)
 #  define check_match(s, start, match, length)
 #endif /* DEBUG */
 
+/* ===========================================================================
+ * Subtract w_size from all hash chain heads and links after the window has
+ * moved down, entries that fall out of the window become NIL. If a position
+ * is not on any hash chain, prev[] for it is garbage but its value will never
+ * be used. Both tables have a power of two size of at least 256 entries.
+ */
+local void slide_hash(s)
+    deflate_state *s;
+{
+    Posf *p;
+    unsigned n;
+    uInt wsize = s->w_size;
+#ifdef DEFLATE_SSE2
+    /* NIL is 0, so this is a saturating subtract, 8 entries at a time */
+    __m128i w = _mm_set1_epi16((short)wsize);
+
+    for (p = s->head, n = s->hash_size; n; p += 8, n -= 8)
+        _mm_storeu_si128((__m128i *)p, _mm_subs_epu16(
+            _mm_loadu_si128((const __m128i *)p), w));
+#  ifndef FASTEST
+    for (p = s->prev, n = wsize; n; p += 8, n -= 8)
+        _mm_storeu_si128((__m128i *)p, _mm_subs_epu16(
+            _mm_loadu_si128((const __m128i *)p), w));
+#  endif
+#else
+    unsigned m;
+
+    n = s->hash_size;
+    p = &s->head[n];
+    do {
+        m = *--p;
+        *p = (Pos)(m >= wsize ? m-wsize : NIL);
+    } while (--n);
+#  ifndef FASTEST
+    n = wsize;
+    p = &s->prev[n];
+    do {
+        m = *--p;
+        *p = (Pos)(m >= wsize ? m-wsize : NIL);
+    } while (--n);
+#  endif
+#endif
+}
+
 /* ===========================================================================
  * Fill the window when the lookahead becomes insufficient.
  * Updates strstart and lookahead.
@@ -1305,8 +1425,7 @@ local void check_match(s, start, match, length)
 local void fill_window(s)
     deflate_state *s;
 {
-    register unsigned n, m;
-    register Posf *p;
+    register unsigned n;
     unsigned more;    /* Amount of free space at the end of the window. */
     uInt wsize = s->w_size;
 
@@ -1342,24 +1461,7 @@ local void fill_window(s)
                later. (Using level 0 permanently is not an optimal usage of
                zlib, so we don't care about this pathological case.)
              */
-            n = s->hash_size;
-            p = &s->head[n];
-            do {
-                m = *--p;
-                *p = (Pos)(m >= wsize ? m-wsize : NIL);
-            } while (--n);
-
-            n = wsize;
-#ifndef FASTEST
-            p = &s->prev[n];
-            do {
-                m = *--p;
-                *p = (Pos)(m >= wsize ? m-wsize : NIL);
-                /* If n is not on any hash chain, prev[n] is garbage but
-                 * its value will never be used.
-                 */
-            } while (--n);
-#endif
+            slide_hash(s);
             more += wsize;
         }
         if (s->strm->avail_in == 0) return;
@@ -1382,11 +1484,7 @@ local void fill_window(s)
 
         /* Initialize the hash value now that we have some input: */
         if (s->lookahead >= MIN_MATCH) {
-            s->ins_h = s->window[s->strstart];
-            UPDATE_HASH(s, s->ins_h, s->window[s->strstart+1]);
-#if MIN_MATCH != 3
-            Call UPDATE_HASH() MIN_MATCH-3 more times
-#endif
+            HASH_INIT(s, s->strstart);
         }
         /* If the whole input has less than MIN_MATCH bytes, ins_h is garbage,
          * but this is not important since only literal bytes will be emitted.
@@ -1549,7 +1647,8 @@ local block_state deflate_fast(s, flush)
         /* Find the longest match, discarding those <= prev_length.
          * At this point we have always match_length < MIN_MATCH
          */
-        if (hash_head != NIL && s->strstart - hash_head <= MAX_DIST(s)) {
+        if ((hash_head != NIL && s->strstart - hash_head <= MAX_DIST(s)) ||
+            (s->stride[0] && s->strstart > 0 && s->lookahead >= MIN_MATCH)) {
             /* To simplify the code, we prevent matches with the string
              * of window index 0 (in particular we have to avoid a match
              * of the string with itself at the start of the input file).
@@ -1585,11 +1684,7 @@ local block_state deflate_fast(s, flush)
             {
                 s->strstart += s->match_length;
                 s->match_length = 0;
-                s->ins_h = s->window[s->strstart];
-                UPDATE_HASH(s, s->ins_h, s->window[s->strstart+1]);
-#if MIN_MATCH != 3
-                Call UPDATE_HASH() MIN_MATCH-3 more times
-#endif
+                HASH_INIT(s, s->strstart);
                 /* If lookahead < MIN_MATCH, ins_h is garbage, but it does not
                  * matter since it will be recomputed at next deflate call.
                  */
@@ -1648,8 +1743,9 @@ local block_state deflate_slow(s, flush)
         s->prev_length = s->match_length, s->prev_match = s->match_start;
         s->match_length = MIN_MATCH-1;
 
-        if (hash_head != NIL && s->prev_length < s->max_lazy_match &&
-            s->strstart - hash_head <= MAX_DIST(s)) {
+        if (s->prev_length < s->max_lazy_match &&
+            ((hash_head != NIL && s->strstart - hash_head <= MAX_DIST(s)) ||
+             (s->stride[0] && s->strstart > 0 && s->lookahead >= MIN_MATCH))) {
             /* To simplify the code, we prevent matches with the string
              * of window index 0 (in particular we have to avoid a match
              * of the string with itself at the start of the input file).
@@ -187,6 +187,11 @@ typedef struct internal_state {
 
     int nice_match; /* Stop searching when current match exceeds this */
 
+    uInt stride[2];
+    /* Distances tried before the hash chain, see deflateStrides(). Unused
+     * entries are zero, stride[1] is only set if stride[0] is.
+     */
+
                 /* used by trees.c: */
     /* Didn't use ct_data typedef below to supress compiler warning */
     struct ct_data_s dyn_ltree[HEAP_SIZE];   /* literal and length tree */
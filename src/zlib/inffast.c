@@ -10,25 +10,107 @@
 
 #ifndef ASMINF
 
-/* Allow machine dependent optimization for post-increment or pre-increment.
-   Based on testing to date,
-   Pre-increment preferred for:
-   - PowerPC G3 (Adler)
-   - MIPS R5000 (Randers-Pehrson)
-   Post-increment preferred for:
-   - none
-   No measurable difference:
-   - Pentium III (Anderson)
-   - M68060 (Nikl)
+/* On 64-bit little-endian machines the bit accumulator is refilled with one
+   unaligned eight byte load per length/distance pair, which supplies at least
+   56 bits -- more than the 48 a pair can use.  Elsewhere it is refilled a
+   byte at a time where needed, as before.  Define INFLATE_FAST_BYTES to use
+   the byte-wise refill everywhere.
  */
-#ifdef POSTINC
-#  define OFF 0
-#  define PUP(a) *(a)++
+#if !defined(INFLATE_FAST_BYTES) && \
+    (defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64) || \
+     (defined(__aarch64__) && defined(__BYTE_ORDER__) && \
+      __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+#  define INFLATE_FAST_64
+#endif
+
+#ifdef INFLATE_FAST_64
+#  ifdef _MSC_VER
+     typedef unsigned __int64 hold_t;
+#  else
+     typedef unsigned long long hold_t;
+#  endif
+#  define INPUT_SLACK 8     /* bytes a refill may read */
+/* Load whole bytes until bits is 56..63.  The load may also bring in part of
+   the next byte above bits; it is loaded again, in the same place, by the
+   next refill, so the accumulator stays consistent. */
+#  define REFILL() \
+    do { \
+        hold_t w_; \
+        zmemcpy((Bytef *)&w_, in, 8); \
+        hold |= w_ << bits; \
+        in += (63 - bits) >> 3; \
+        bits |= 56; \
+    } while (0)
+#  define NEEDBITS(n)       /* always there after REFILL() */
 #else
-#  define OFF 1
-#  define PUP(a) *++(a)
+   typedef unsigned long hold_t;
+#  define INPUT_SLACK 6
+#  define REFILL() NEEDBITS(15)
+#  define NEEDBITS(n) \
+    do { \
+        if (bits < (unsigned)(n)) { \
+            hold += (hold_t)(*in++) << bits; \
+            bits += 8; \
+            if (bits < (unsigned)(n)) { \
+                hold += (hold_t)(*in++) << bits; \
+                bits += 8; \
+            } \
+        } \
+    } while (0)
 #endif
 
+/* Copy a match of len bytes from dist bytes back in the output, in chunks of
+   16 or 8 bytes where the distance allows: a chunk never starts before its
+   source is complete.  For dist < 8 the pattern is first spread over eight
+   bytes.  Nothing is written past out + len, since inflateBack() decodes
+   straight into its window, where those bytes are still history. */
+local unsigned char FAR *chunk_copy OF((unsigned char FAR *out,
+                                        unsigned dist, unsigned len));
+
+local unsigned char FAR *chunk_copy(out, dist, len)
+unsigned char FAR *out;
+unsigned dist;
+unsigned len;
+{
+    const unsigned char FAR *from = out - dist;
+
+    if (dist >= 16) {
+        while (len >= 16) {
+            zmemcpy(out, from, 16);
+            out += 16;
+            from += 16;
+            len -= 16;
+        }
+    }
+    if (dist >= 8) {
+        while (len >= 8) {
+            zmemcpy(out, from, 8);
+            out += 8;
+            from += 8;
+            len -= 8;
+        }
+    }
+    else if (len >= 8) {
+        unsigned char pat[8];
+        unsigned i, step;
+
+        for (i = 0; i < 8; i++)
+            pat[i] = from[i % dist];
+        step = 8 - 8 % dist;            /* whole periods per store */
+        do {
+            zmemcpy(out, pat, 8);
+            out += step;
+            len -= step;
+        } while (len >= 8);
+        from = out - dist;
+    }
+    while (len) {
+        *out++ = *from++;
+        len--;
+    }
+    return out;
+}
+
 /*
    Decode literal, length, and distance codes and write out the resulting
    literal and match bytes until either not enough input or output is
@@ -40,8 +122,8 @@
    Entry assumptions:
 
         state->mode == LEN
-        strm->avail_in >= 6
-        strm->avail_out >= 258
+        strm->avail_in >= INFLATE_FAST_MIN_INPUT
+        strm->avail_out >= INFLATE_FAST_MIN_OUTPUT
         start >= strm->avail_out
         state->bits < 8
 
@@ -56,8 +138,8 @@
     - The maximum input bits used by a length/distance pair is 15 bits for the
       length code, 5 bits for the length extra, 15 bits for the distance code,
       and 13 bits for the distance extra.  This totals 48 bits, or six bytes.
-      Therefore if strm->avail_in >= 6, then there is enough input to avoid
-      checking for available input while decoding.
+      A refill reads at most INPUT_SLACK bytes, so as long as that many are
+      left there is no need to check for available input while decoding.
 
     - The maximum bytes that a single length/distance pair can output is 258
       bytes, which is the maximum length that can be coded.  inflate_fast()
@@ -81,7 +163,7 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
     unsigned whave;             /* valid bytes in the window */
     unsigned wnext;             /* window write index */
     unsigned char FAR *window;  /* allocated sliding window, if wsize != 0 */
-    unsigned long hold;         /* local strm->hold */
+    hold_t hold;                /* local strm->hold */
     unsigned bits;              /* local strm->bits */
     code const FAR *lcode;      /* local strm->lencode */
     code const FAR *dcode;      /* local strm->distcode */
@@ -96,11 +178,11 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
 
     /* copy state to local variables */
     state = (struct inflate_state FAR *)strm->state;
-    in = strm->next_in - OFF;
-    last = in + (strm->avail_in - 5);
-    out = strm->next_out - OFF;
+    in = strm->next_in;
+    last = in + (strm->avail_in - (INPUT_SLACK - 1));
+    out = strm->next_out;
     beg = out - (start - strm->avail_out);
-    end = out + (strm->avail_out - 257);
+    end = out + (strm->avail_out - (INFLATE_FAST_MIN_OUTPUT - 1));
 #ifdef INFLATE_STRICT
     dmax = state->dmax;
 #endif
@@ -118,12 +200,7 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
     /* decode literals and length/distances until end-of-block or not enough
        input data or output space */
     do {
-        if (bits < 15) {
-            hold += (unsigned long)(PUP(in)) << bits;
-            bits += 8;
-            hold += (unsigned long)(PUP(in)) << bits;
-            bits += 8;
-        }
+        REFILL();
         here = lcode[hold & lmask];
       dolen:
         op = (unsigned)(here.bits);
@@ -134,27 +211,19 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
             Tracevv((stderr, here.val >= 0x20 && here.val < 0x7f ?
                     "inflate:         literal '%c'\n" :
                     "inflate:         literal 0x%02x\n", here.val));
-            PUP(out) = (unsigned char)(here.val);
+            *out++ = (unsigned char)(here.val);
         }
         else if (op & 16) {                     /* length base */
             len = (unsigned)(here.val);
             op &= 15;                           /* number of extra bits */
             if (op) {
-                if (bits < op) {
-                    hold += (unsigned long)(PUP(in)) << bits;
-                    bits += 8;
-                }
+                NEEDBITS(op);
                 len += (unsigned)hold & ((1U << op) - 1);
                 hold >>= op;
                 bits -= op;
             }
             Tracevv((stderr, "inflate:         length %u\n", len));
-            if (bits < 15) {
-                hold += (unsigned long)(PUP(in)) << bits;
-                bits += 8;
-                hold += (unsigned long)(PUP(in)) << bits;
-                bits += 8;
-            }
+            NEEDBITS(15);
             here = dcode[hold & dmask];
           dodist:
             op = (unsigned)(here.bits);
@@ -164,14 +233,7 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
             if (op & 16) {                      /* distance base */
                 dist = (unsigned)(here.val);
                 op &= 15;                       /* number of extra bits */
-                if (bits < op) {
-                    hold += (unsigned long)(PUP(in)) << bits;
-                    bits += 8;
-                    if (bits < op) {
-                        hold += (unsigned long)(PUP(in)) << bits;
-                        bits += 8;
-                    }
-                }
+                NEEDBITS(op);
                 dist += (unsigned)hold & ((1U << op) - 1);
 #ifdef INFLATE_STRICT
                 if (dist > dmax) {
@@ -196,89 +258,53 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
 #ifdef INFLATE_ALLOW_INVALID_DISTANCE_TOOFAR_ARRR
                         if (len <= op - whave) {
                             do {
-                                PUP(out) = 0;
+                                *out++ = 0;
                             } while (--len);
                             continue;
                         }
                         len -= op - whave;
                         do {
-                            PUP(out) = 0;
+                            *out++ = 0;
                         } while (--op > whave);
                         if (op == 0) {
                             from = out - dist;
                             do {
-                                PUP(out) = PUP(from);
+                                *out++ = *from++;
                             } while (--len);
                             continue;
                         }
 #endif
                     }
-                    from = window - OFF;
+                    /* The window is copied exactly, it has no slack past its
+                       end; whatever follows comes from the output. */
+                    from = window;
                     if (wnext == 0) {           /* very common case */
                         from += wsize - op;
-                        if (op < len) {         /* some from window */
-                            len -= op;
-                            do {
-                                PUP(out) = PUP(from);
-                            } while (--op);
-                            from = out - dist;  /* rest from output */
-                        }
                     }
                     else if (wnext < op) {      /* wrap around window */
                         from += wsize + wnext - op;
                         op -= wnext;
                         if (op < len) {         /* some from end of window */
                             len -= op;
-                            do {
-                                PUP(out) = PUP(from);
-                            } while (--op);
-                            from = window - OFF;
-                            if (wnext < len) {  /* some from start of window */
-                                op = wnext;
-                                len -= op;
-                                do {
-                                    PUP(out) = PUP(from);
-                                } while (--op);
-                                from = out - dist;      /* rest from output */
-                            }
+                            zmemcpy(out, from, op);
+                            out += op;
+                            from = window;      /* rest from start of window */
+                            op = wnext;
                         }
                     }
                     else {                      /* contiguous in window */
                         from += wnext - op;
-                        if (op < len) {         /* some from window */
-                            len -= op;
-                            do {
-                                PUP(out) = PUP(from);
-                            } while (--op);
-                            from = out - dist;  /* rest from output */
-                        }
-                    }
-                    while (len > 2) {
-                        PUP(out) = PUP(from);
-                        PUP(out) = PUP(from);
-                        PUP(out) = PUP(from);
-                        len -= 3;
                     }
-                    if (len) {
-                        PUP(out) = PUP(from);
-                        if (len > 1)
-                            PUP(out) = PUP(from);
-                    }
-                }
-                else {
-                    from = out - dist;          /* copy direct from output */
-                    do {                        /* minimum length is three */
-                        PUP(out) = PUP(from);
-                        PUP(out) = PUP(from);
-                        PUP(out) = PUP(from);
-                        len -= 3;
-                    } while (len > 2);
-                    if (len) {
-                        PUP(out) = PUP(from);
-                        if (len > 1)
-                            PUP(out) = PUP(from);
+                    if (op >= len) {            /* all of it from the window */
+                        zmemcpy(out, from, len);
+                        out += len;
+                        continue;
                     }
+                    len -= op;
+                    zmemcpy(out, from, op);
+                    out += op;
                 }
+                out = chunk_copy(out, dist, len);
             }
             else if ((op & 64) == 0) {          /* 2nd level distance code */
                 here = dcode[here.val + (hold & ((1U << op) - 1))];
@@ -313,12 +339,14 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
     hold &= (1U << bits) - 1;
 
     /* update state and return */
-    strm->next_in = in + OFF;
-    strm->next_out = out + OFF;
-    strm->avail_in = (unsigned)(in < last ? 5 + (last - in) : 5 - (in - last));
+    strm->next_in = in;
+    strm->next_out = out;
+    strm->avail_in = (unsigned)(in < last ? (INPUT_SLACK - 1) + (last - in) :
+                                (INPUT_SLACK - 1) - (in - last));
     strm->avail_out = (unsigned)(out < end ?
-                                 257 + (end - out) : 257 - (out - end));
-    state->hold = hold;
+                                 (INFLATE_FAST_MIN_OUTPUT - 1) + (end - out) :
+                                 (INFLATE_FAST_MIN_OUTPUT - 1) - (out - end));
+    state->hold = (unsigned long)hold;
     state->bits = bits;
     return;
 }
@@ -335,6 +363,9 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
    - Swapping window/direct else
    - Larger unrolled copy loops (three is about right)
    - Moving len -= 3 statement into middle of loop
+
+   On current x86-64 CPUs, refilling eight bytes at a time and copying
+   matches in chunks is a clear win, see above.
  */
 
 #endif /* !ASMINF */
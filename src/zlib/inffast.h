@@ -8,4 +8,9 @@
    subject to change. Applications should only use zlib.h.
  */
 
+/* inflate() and inflateBack() use inflate_fast() while at least this much
+   input and output space is available */
+#define INFLATE_FAST_MIN_INPUT 8
+#define INFLATE_FAST_MIN_OUTPUT 258
+
 void ZLIB_INTERNAL inflate_fast OF((z_streamp strm, unsigned start));
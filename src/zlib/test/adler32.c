@@ -0,0 +1,134 @@
+/* adler32.c -- test of the SIMD versions of adler32() against a scalar loop
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * Checks adler32_ssse3() and adler32_avx2() (where the CPU has them) and
+ * adler32() itself for random lengths, buffer offsets and start values,
+ * and for all-0xff input, the worst case for the deferred modulo.  Also
+ * prints the speed of each version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "zutil.h"
+#include "cpu_features.h"
+#include "adler32_simd.h"
+
+#define BASE 65521UL
+#define MAX_LEN (5552 * 8 + 1000)   /* several NMAX blocks */
+#define RUNS 2000
+#define BENCH_BYTES (64UL << 20)
+
+typedef uLong (*adler_func) OF((uLong adler, const Bytef *buf, uInt len));
+
+static uLong reference(uLong adler, const Bytef *buf, uInt len)
+{
+    uLong a = adler & 0xffff, b = adler >> 16;
+
+    while (len--) {
+        a = (a + *buf++) % BASE;
+        b = (b + a) % BASE;
+    }
+    return a | (b << 16);
+}
+
+static unsigned long rnd = 1;
+
+static unsigned long next_rand(void)
+{
+    rnd = rnd * 1103515245UL + 12345UL;
+    return (rnd >> 8) & 0xffffff;
+}
+
+static uLong random_adler(void)
+{
+    return (next_rand() % BASE) | ((next_rand() % BASE) << 16);
+}
+
+static int check(const char *name, adler_func f, const Bytef *data,
+                 const Bytef *ones)
+{
+    unsigned i;
+    int failed = 0;
+
+    for (i = 0; i < RUNS && !failed; i++) {
+        uInt off = (uInt)(next_rand() % 64);
+        uInt len = (uInt)(next_rand() % (MAX_LEN - off));
+        uLong start = i % 4 ? random_adler() : 1;
+
+        if (f(start, data + off, len) != reference(start, data + off, len)) {
+            printf("adler32: %s differs, offset %u length %u\n", name, off, len);
+            failed = 1;
+        }
+    }
+    for (i = 0; i <= MAX_LEN && !failed; i += i < 256 ? 1 : 997) {
+        uLong start = (BASE - 1) | ((BASE - 1) << 16);
+
+        if (f(start, ones, i) != reference(start, ones, i)) {
+            printf("adler32: %s differs on 0xff, length %u\n", name, i);
+            failed = 1;
+        }
+    }
+    return failed;
+}
+
+static void bench(const char *name, adler_func f, const Bytef *data)
+{
+    uLong adler = 1, done;
+    clock_t t = clock();
+    double s;
+
+    for (done = 0; done < BENCH_BYTES; done += MAX_LEN)
+        adler = f(adler, data, MAX_LEN);
+    s = (double)(clock() - t) / CLOCKS_PER_SEC;
+    printf("adler32: %-6s %8.0f MB/s (%08lx)\n", name,
+           s > 0 ? BENCH_BYTES / s / 1e6 : 0.0, adler);
+}
+
+int main(void)
+{
+    Bytef *data = (Bytef *)malloc(MAX_LEN + 64);
+    Bytef *ones = (Bytef *)malloc(MAX_LEN + 64);
+    int failed = 0;
+#ifdef X86_SIMD
+    int features = x86_cpu_features();
+#endif
+    unsigned i;
+
+    for (i = 0; i < MAX_LEN + 64; i++)
+        data[i] = (Bytef)next_rand();
+    memset(ones, 0xff, MAX_LEN + 64);
+
+    failed |= check("adler32", adler32, data, ones);
+#ifdef X86_SIMD
+    if (features & X86_SSSE3)
+        failed |= check("ssse3", adler32_ssse3, data, ones);
+    else
+        printf("adler32: no SSSE3, skipped\n");
+#ifdef X86_AVX2_SIMD
+    if (features & X86_AVX2)
+        failed |= check("avx2", adler32_avx2, data, ones);
+    else
+        printf("adler32: no AVX2, skipped\n");
+#endif
+#else
+    printf("adler32: built without SIMD versions\n");
+#endif
+
+    if (!failed) {
+        bench("scalar", reference, data);
+        bench("adler32", adler32, data);
+#ifdef X86_SIMD
+        if (features & X86_SSSE3)
+            bench("ssse3", adler32_ssse3, data);
+#ifdef X86_AVX2_SIMD
+        if (features & X86_AVX2)
+            bench("avx2", adler32_avx2, data);
+#endif
+#endif
+    }
+    free(data);
+    free(ones);
+    return failed;
+}
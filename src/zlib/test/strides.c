@@ -0,0 +1,70 @@
+/* strides.c -- regression test for deflateStrides()
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * Compresses image-like rows with strides set, switching between
+ * deflate_fast and deflate_slow with deflateParams() mid-stream (which can
+ * leave prev_length at 0), and checks that the data inflates back.  Run it
+ * under AddressSanitizer to catch reads before the window.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zlib.h"
+
+#define WIDTH 97            /* pixels per row, 4 bytes each */
+#define ROWS 256
+#define ROW_BYTES (WIDTH * 4 + 1)
+#define SIZE (ROW_BYTES * ROWS)
+
+static int check(const unsigned char *data, uLong size, int level1, int level2)
+{
+    z_stream z;
+    uLong bound = compressBound(size) + 64, half = size / 2;
+    unsigned char *comp = (unsigned char *)malloc(bound);
+    unsigned char *back = (unsigned char *)malloc(size);
+    int ok;
+
+    memset(&z, 0, sizeof(z));
+    if (deflateInit(&z, level1) != Z_OK ||
+        deflateStrides(&z, 4, ROW_BYTES) != Z_OK)
+        return 0;
+    z.next_out = comp;
+    z.avail_out = (uInt)bound;
+
+    /* a single byte first: deflate runs at strstart 0 with no lookahead */
+    z.next_in = (Bytef *)data;
+    z.avail_in = 1;
+    if (deflate(&z, Z_NO_FLUSH) != Z_OK) return 0;
+    z.avail_in = (uInt)(half - 1);
+    if (deflate(&z, Z_NO_FLUSH) != Z_OK) return 0;
+    if (deflateParams(&z, level2, Z_DEFAULT_STRATEGY) != Z_OK) return 0;
+    z.avail_in = (uInt)(size - half);
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END) return 0;
+    bound = z.total_out;
+    deflateEnd(&z);
+
+    ok = uncompress(back, &size, comp, bound) == Z_OK &&
+         !memcmp(back, data, size);
+    free(comp);
+    free(back);
+    return ok;
+}
+
+int main(void)
+{
+    static const int levels[][2] = { {1, 6}, {6, 1}, {1, 9}, {9, 2} };
+    unsigned char *data = (unsigned char *)malloc(SIZE);
+    unsigned i;
+    int failed = 0;
+
+    for (i = 0; i < SIZE; i++)
+        data[i] = i % ROW_BYTES == 0 ? 1 : (unsigned char)((i / 4 % 7) * 31 + i % 4);
+    for (i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+        if (!check(data, SIZE, levels[i][0], levels[i][1])) {
+            printf("strides: level %d -> %d failed\n", levels[i][0], levels[i][1]);
+            failed = 1;
+        }
+    free(data);
+    return failed;
+}
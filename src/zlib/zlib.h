@@ -681,6 +681,26 @@ ZEXTERN int ZEXPORT deflateTune OF((z_streamp strm,
    returns Z_OK on success, or Z_STREAM_ERROR for an invalid deflate stream.
  */
 
+ZEXTERN int ZEXPORT deflateStrides OF((z_streamp strm,
+                                       uInt dist1,
+                                       uInt dist2));
+/*
+     Gives deflate up to two distances at which matches are likely, for data
+   with a fixed record structure.  For filtered PNG image rows these are the
+   bytes per pixel (the pixel to the left) and the row length plus one (the
+   pixel above, after the filter type byte).  Before walking the hash chain
+   for a string, deflate then also compares it with the strings at these
+   distances, which finds such matches even when they are far down the chain
+   at low compression levels.  A distance of zero is not used; deflateStrides
+   (strm, 0, 0) turns the probing off again.  The setting is kept across
+   deflateReset() and deflateParams().
+
+     deflateStrides() can be called after deflateInit() or deflateInit2(), and
+   returns Z_OK on success, or Z_STREAM_ERROR for an invalid deflate stream or
+   if this build of deflate does not support it (FASTEST or ASMV).  The
+   distances do not affect decompression in any way.
+ */
+
 ZEXTERN uLong ZEXPORT deflateBound OF((z_streamp strm,
                                        uLong sourceLen));
 /*